@@ -0,0 +1,239 @@
+// Animation microbenchmarks. Needs no window or GL context: skeletons and
+// clips are generated in memory and fed through the same Assimp structures a
+// real import produces. Results are printed as JSON so runs can be diffed.
+//
+//   animation_bench [--quick]
+//
+// --quick shortens every measurement, for smoke testing the build. Every
+// entry reports ns per character and per bone, except find_bone which times
+// a single lookup by name.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/animation.hpp"
+
+// skeleton shapes: bone count and length of each chain hanging off the root
+struct SkeletonShape {
+  int bones;
+  int depth;
+};
+
+const SkeletonShape skeleton_shapes[] = {
+    {50, 5}, {50, 25}, {200, 10}, {1000, 10}, {1000, 100},
+};
+
+const int key_counts[] = {10, 100, 1000, 10000};
+
+// skip clips with more keys than this in total, they only measure memory
+const long max_total_keys = 2000000;
+
+double min_seconds = 0.05;
+
+std::string bone_name(int i) { return "bone_" + std::to_string(i); }
+
+// Builds a channel with evenly spaced keys, one tick apart.
+aiNodeAnim *make_channel(const std::string &name, int num_keys, float phase) {
+  aiNodeAnim *channel = new aiNodeAnim();
+  channel->mNodeName = aiString(name);
+
+  channel->mNumPositionKeys = num_keys;
+  channel->mPositionKeys = new aiVectorKey[num_keys];
+  channel->mNumRotationKeys = num_keys;
+  channel->mRotationKeys = new aiQuatKey[num_keys];
+  channel->mNumScalingKeys = num_keys;
+  channel->mScalingKeys = new aiVectorKey[num_keys];
+
+  for (int i = 0; i < num_keys; i++) {
+    float t = static_cast<float>(i);
+    float angle = phase + t * 0.01f;
+    channel->mPositionKeys[i].mTime = t;
+    channel->mPositionKeys[i].mValue = aiVector3D(t, 0.5f * t, 0.0f);
+    channel->mRotationKeys[i].mTime = t;
+    channel->mRotationKeys[i].mValue =
+        aiQuaternion(std::cos(angle), std::sin(angle), 0.0f, 0.0f);
+    channel->mScalingKeys[i].mTime = t;
+    channel->mScalingKeys[i].mValue = aiVector3D(1.0f, 1.0f, 1.0f);
+  }
+  return channel;
+}
+
+// A root with bones / depth chains of depth bones each. Node i's parent is
+// i - 1 unless it starts a new chain.
+aiNode *make_hierarchy(const SkeletonShape &shape) {
+  std::vector<aiNode *> nodes(shape.bones);
+  std::vector<std::vector<aiNode *>> children(shape.bones + 1);
+  aiNode *root = new aiNode("root");
+  for (int i = 0; i < shape.bones; i++) {
+    nodes[i] = new aiNode(bone_name(i));
+    // a small turn about y and one unit up from the parent
+    aiMatrix4x4 &m = nodes[i]->mTransformation;
+    m.a1 = std::cos(0.1f);
+    m.a3 = std::sin(0.1f);
+    m.c1 = -std::sin(0.1f);
+    m.c3 = std::cos(0.1f);
+    m.b4 = 1.0f;
+    int parent = i % shape.depth == 0 ? -1 : i - 1;
+    children[parent + 1].push_back(nodes[i]);
+    nodes[i]->mParent = parent == -1 ? root : nodes[parent];
+  }
+
+  for (int i = 0; i <= shape.bones; i++) {
+    aiNode *node = i == 0 ? root : nodes[i - 1];
+    if (children[i].empty())
+      continue;
+    node->mNumChildren = children[i].size();
+    node->mChildren = new aiNode *[children[i].size()];
+    std::copy(children[i].begin(), children[i].end(), node->mChildren);
+  }
+  return root;
+}
+
+aiAnimation *make_clip(int bones, int num_keys) {
+  aiAnimation *clip = new aiAnimation();
+  clip->mName = aiString(std::string("bench_clip"));
+  clip->mDuration = num_keys - 1;
+  clip->mTicksPerSecond = 30.0;
+  clip->mNumChannels = bones;
+  clip->mChannels = new aiNodeAnim *[bones];
+  for (int i = 0; i < bones; i++)
+    clip->mChannels[i] = make_channel(bone_name(i), num_keys, i * 0.37f);
+  return clip;
+}
+
+// runs body until min_seconds have passed, returns ns per call
+template <typename Body> double ns_per_call(Body body) {
+  using clock = std::chrono::steady_clock;
+  long calls = 0;
+  auto start = clock::now();
+  double elapsed = 0.0;
+  do {
+    for (int i = 0; i < 16; i++)
+      body();
+    calls += 16;
+    elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  } while (elapsed < min_seconds);
+  return elapsed * 1e9 / calls;
+}
+
+struct Result {
+  std::string name;
+  int bones;
+  int depth;
+  int keys;
+  double ns_per_call;
+  int per; // what ns_per_call is divided by for ns_per_bone
+};
+
+std::vector<Result> results;
+
+void report(const std::string &name, const SkeletonShape &shape, int keys,
+            double ns, int per) {
+  results.push_back({name, shape.bones, shape.depth, keys, ns, per});
+}
+
+void bench_character(const SkeletonShape &shape, int num_keys) {
+  std::unique_ptr<aiNode> root(make_hierarchy(shape));
+  std::unique_ptr<aiAnimation> clip_data(make_clip(shape.bones, num_keys));
+
+  std::map<std::string, BoneInfo> bone_info_map;
+  for (int i = 0; i < shape.bones; i++)
+    bone_info_map[bone_name(i)] = {i, glm::mat4(1.0f)};
+  auto skeleton = std::make_shared<Skeleton>(root.get(), bone_info_map);
+  Animation clip(clip_data.get(), skeleton);
+
+  // playback advances like Animator does, one 60 Hz frame per call
+  float duration = clip.GetDuration();
+  float step = clip.GetTicksPerSecond() / 60.0f;
+  float time = 0.0f;
+  auto advance = [&]() {
+    time = std::fmod(time + step, duration);
+    return time;
+  };
+
+  std::vector<KeyCursor> cursors(clip.GetBoneCount());
+  std::vector<glm::mat4> globals(clip.GetNodeCount());
+  std::vector<glm::mat4> palette(clip.GetPaletteSize());
+  LocalPose pose;
+  clip.SamplePose(0.0f, cursors.data(), pose);
+
+  report("sample", shape, num_keys, ns_per_call([&]() {
+           clip.SamplePose(advance(), cursors.data(), pose);
+         }),
+         shape.bones);
+  report("hierarchy", shape, num_keys,
+         ns_per_call([&]() { clip.ComputeGlobals(pose, globals.data()); }),
+         shape.bones);
+  report("palette", shape, num_keys, ns_per_call([&]() {
+           clip.ComputeSkinMatrices(globals.data(), palette.data());
+         }),
+         shape.bones);
+
+  Animator animator(&clip);
+  report("animator", shape, num_keys,
+         ns_per_call([&]() { animator.UpdateAnimation(1.0f / 60.0f); }),
+         shape.bones);
+
+  // random seeks defeat the key cursors and exercise the binary search
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> dist(0.0f, duration);
+  report("sample_seek", shape, num_keys, ns_per_call([&]() {
+           clip.SamplePose(dist(rng), cursors.data(), pose);
+         }),
+         shape.bones);
+
+  // name lookups only depend on the bone count
+  if (num_keys == key_counts[0]) {
+    int bone = 0;
+    std::vector<std::string> names;
+    for (int i = 0; i < shape.bones; i++)
+      names.push_back(bone_name(i));
+    report("find_bone", shape, 0, ns_per_call([&]() {
+             clip.FindBone(names[bone]);
+             bone = (bone + 1) % shape.bones;
+           }),
+           1);
+  }
+}
+
+void print_json() {
+  std::printf("{\n  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &r = results[i];
+    std::printf("    {\"name\": \"%s\", \"bones\": %d, \"depth\": %d, "
+                "\"keys\": %d, \"ns_per_character\": %.1f, "
+                "\"ns_per_bone\": %.3f}%s\n",
+                r.name.c_str(), r.bones, r.depth, r.keys, r.ns_per_call,
+                r.ns_per_call / r.per, i + 1 < results.size() ? "," : "");
+  }
+  std::printf("  ]\n}\n");
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--quick") == 0) {
+      min_seconds = 0.002;
+    } else {
+      std::fprintf(stderr, "usage: %s [--quick]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  for (const SkeletonShape &shape : skeleton_shapes) {
+    for (int num_keys : key_counts) {
+      if ((long)shape.bones * num_keys > max_total_keys)
+        continue;
+      std::fprintf(stderr, "%d bones, depth %d, %d keys\n", shape.bones,
+                   shape.depth, num_keys);
+      bench_character(shape, num_keys);
+    }
+  }
+  print_json();
+  return 0;
+}
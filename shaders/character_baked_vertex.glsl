@@ -0,0 +1,84 @@
+#version 330 core
+
+const int MAX_BONE_INFLUENCE = 4;
+const int MAX_CLIPS = 16;
+
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec2 packedNormal;
+layout(location = 2) in vec2 textureCoords;
+
+layout(location = 3) in uvec4 boneIds; // unused slots have weight 0
+layout(location = 4) in vec4 weights;
+
+// per instance
+layout(location = 5) in vec4 placement; // xyz position, w yaw
+layout(location = 6) in vec2 animation; // x clip id, y time offset
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform float scale;
+
+// one row per baked frame, four texels (matrix columns) per bone
+uniform sampler2D boneTexture;
+uniform vec2 clips[MAX_CLIPS]; // first row, frame count
+uniform float sampleRate;
+uniform float time;
+
+out vec3 fragmentPosition;
+out vec3 fragmentNormal;
+out vec2 fragmentTextureCoords;
+
+// normals arrive octahedral encoded (see VertexFormat in vertex_format.hpp)
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+mat4 boneMatrix(int bone, int row) {
+    int x = bone * 4;
+    return mat4(texelFetch(boneTexture, ivec2(x, row), 0),
+                texelFetch(boneTexture, ivec2(x + 1, row), 0),
+                texelFetch(boneTexture, ivec2(x + 2, row), 0),
+                texelFetch(boneTexture, ivec2(x + 3, row), 0));
+}
+
+void main() {
+    vec2 clip = clips[int(animation.x)];
+    int firstRow = int(clip.x);
+    int frameCount = int(clip.y);
+
+    // blend the two baked frames either side of the current time
+    float frame = (time + animation.y) * sampleRate;
+    float blend = fract(frame);
+    int frame0 = int(mod(floor(frame), float(frameCount)));
+    int frame1 = (frame0 + 1) % frameCount;
+
+    vec3 normal = octDecode(packedNormal);
+    vec4 totalPosition = vec4(0);
+    vec3 totalNormal = vec3(0);
+    for (int i = 0; i < MAX_BONE_INFLUENCE; i++) {
+        if (weights[i] == 0.0)
+            continue;
+        int boneId = int(boneIds[i]);
+        mat4 bone = mix(boneMatrix(boneId, firstRow + frame0),
+                        boneMatrix(boneId, firstRow + frame1), blend);
+        totalPosition += bone * vec4(pos, 1.0f) * weights[i];
+        totalNormal += mat3(bone) * normal * weights[i];
+    }
+
+    float c = cos(placement.w);
+    float s = sin(placement.w);
+    mat4 model = mat4(
+        vec4(c * scale, 0.0f, -s * scale, 0.0f),
+        vec4(0.0f, scale, 0.0f, 0.0f),
+        vec4(s * scale, 0.0f, c * scale, 0.0f),
+        vec4(placement.xyz, 1.0f));
+
+    fragmentTextureCoords = textureCoords;
+    fragmentNormal = mat3(model) * totalNormal;
+    fragmentPosition = vec3(model * totalPosition);
+    gl_Position = projection * view * vec4(fragmentPosition, 1.0f);
+}
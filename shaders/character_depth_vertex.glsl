@@ -0,0 +1,54 @@
+#version 330 core
+
+const int MAX_BONE_INFLUENCE = 4;
+
+layout(location = 0) in vec3 pos;
+
+layout(location = 3) in uvec4 boneIds; // unused slots have weight 0
+layout(location = 4) in vec4 weights;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform mat4 model;
+
+// same palette as character_vertex.glsl
+uniform samplerBuffer finalBonesMatrices;
+uniform int paletteOffset;
+uniform int paletteSize; // matrices in this instance's palette
+
+// summed blend shape deltas, one texel per vertex (see MorphTargets)
+uniform int hasMorphTargets;
+uniform sampler2D morphPositions;
+
+ivec2 morphTexel() {
+    int width = textureSize(morphPositions, 0).x;
+    return ivec2(gl_VertexID % width, gl_VertexID / width);
+}
+
+mat4 boneMatrix(int bone) {
+    int texel = (paletteOffset + bone) * 4;
+    return mat4(texelFetch(finalBonesMatrices, texel),
+                texelFetch(finalBonesMatrices, texel + 1),
+                texelFetch(finalBonesMatrices, texel + 2),
+                texelFetch(finalBonesMatrices, texel + 3));
+}
+
+void main() {
+    vec3 morphedPos = pos;
+    if (hasMorphTargets == 1) {
+        morphedPos += texelFetch(morphPositions, morphTexel(), 0).xyz;
+    }
+
+    vec4 totalPosition = vec4(0);
+    for (int i = 0; i < MAX_BONE_INFLUENCE; i++) {
+        if (weights[i] == 0.0)
+            continue;
+        int boneId = int(boneIds[i]);
+        if (boneId >= paletteSize) {
+            totalPosition = vec4(morphedPos, 1.0f);
+            break;
+        }
+        totalPosition += boneMatrix(boneId) * vec4(morphedPos, 1.0f) * weights[i];
+    }
+    gl_Position = projection * view * model * totalPosition;
+}
@@ -0,0 +1,23 @@
+#version 330 core
+
+// positions and normals come from the pre-skinning pass, texture coordinates
+// from the mesh itself
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 textureCoords;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform mat4 model;
+
+out vec3 fragmentPosition;
+out vec3 fragmentNormal;
+out vec2 fragmentTextureCoords;
+
+void main() {
+    gl_Position = projection * view * model * vec4(pos, 1.0f);
+    fragmentTextureCoords = textureCoords;
+
+    fragmentNormal = mat3(transpose(inverse(model))) * normal;
+    fragmentPosition = vec3(model * vec4(pos, 1.0f));
+}
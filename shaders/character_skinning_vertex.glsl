@@ -0,0 +1,74 @@
+#version 330 core
+
+const int MAX_BONE_INFLUENCE = 4;
+
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec2 packedNormal;
+
+layout(location = 3) in uvec4 boneIds; // unused slots have weight 0
+layout(location = 4) in vec4 weights;
+
+// same palette as character_vertex.glsl
+uniform samplerBuffer finalBonesMatrices;
+uniform int paletteOffset;
+uniform int paletteSize; // matrices in this instance's palette
+
+// captured by transform feedback, still in model space
+out vec3 skinnedPosition;
+out vec3 skinnedNormal;
+
+// summed blend shape deltas, one texel per vertex (see MorphTargets)
+uniform int hasMorphTargets;
+uniform sampler2D morphPositions;
+uniform sampler2D morphNormals;
+
+ivec2 morphTexel() {
+    int width = textureSize(morphPositions, 0).x;
+    return ivec2(gl_VertexID % width, gl_VertexID / width);
+}
+
+// normals arrive octahedral encoded (see VertexFormat in vertex_format.hpp)
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+mat4 boneMatrix(int bone) {
+    int texel = (paletteOffset + bone) * 4;
+    return mat4(texelFetch(finalBonesMatrices, texel),
+                texelFetch(finalBonesMatrices, texel + 1),
+                texelFetch(finalBonesMatrices, texel + 2),
+                texelFetch(finalBonesMatrices, texel + 3));
+}
+
+void main() {
+    vec3 morphedPos = pos;
+    vec3 morphedNormal = octDecode(packedNormal);
+    if (hasMorphTargets == 1) {
+        morphedPos += texelFetch(morphPositions, morphTexel(), 0).xyz;
+        morphedNormal += texelFetch(morphNormals, morphTexel(), 0).xyz;
+    }
+
+    vec4 totalPosition = vec4(0);
+    vec3 totalNormal = vec3(0);
+    for (int i = 0; i < MAX_BONE_INFLUENCE; i++) {
+        if (weights[i] == 0.0)
+            continue;
+        int boneId = int(boneIds[i]);
+        if (boneId >= paletteSize) {
+            totalPosition = vec4(morphedPos, 1.0f);
+            totalNormal = morphedNormal;
+            break;
+        }
+
+        mat4 bone = boneMatrix(boneId);
+        totalPosition += bone * vec4(morphedPos, 1.0f) * weights[i];
+        totalNormal += mat3(bone) * morphedNormal * weights[i];
+    }
+
+    skinnedPosition = totalPosition.xyz;
+    skinnedNormal = normalize(totalNormal);
+}
@@ -1,44 +1,80 @@
 #version 330 core
 
-const int MAX_BONES = 100;
 const int MAX_BONE_INFLUENCE = 4;
 
 layout(location = 0) in vec3 pos;
-layout(location = 1) in vec3 normal;
+layout(location = 1) in vec2 packedNormal;
 layout(location = 2) in vec2 textureCoords;
 
-layout(location = 3) in ivec4 boneIds;
+layout(location = 3) in uvec4 boneIds; // unused slots have weight 0
 layout(location = 4) in vec4 weights;
 
 uniform mat4 projection;
 uniform mat4 view;
 uniform mat4 model;
 
-uniform mat4 finalBonesMatrices[MAX_BONES];
+// four texels (matrix columns) per bone, starting at paletteOffset
+uniform samplerBuffer finalBonesMatrices;
+uniform int paletteOffset;
+uniform int paletteSize; // matrices in this instance's palette
 
 out vec3 fragmentPosition;
 out vec3 fragmentNormal;
 out vec2 fragmentTextureCoords;
 
+// summed blend shape deltas, one texel per vertex (see MorphTargets)
+uniform int hasMorphTargets;
+uniform sampler2D morphPositions;
+uniform sampler2D morphNormals;
+
+ivec2 morphTexel() {
+    int width = textureSize(morphPositions, 0).x;
+    return ivec2(gl_VertexID % width, gl_VertexID / width);
+}
+
+// normals arrive octahedral encoded (see VertexFormat in vertex_format.hpp)
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+mat4 boneMatrix(int bone) {
+    int texel = (paletteOffset + bone) * 4;
+    return mat4(texelFetch(finalBonesMatrices, texel),
+                texelFetch(finalBonesMatrices, texel + 1),
+                texelFetch(finalBonesMatrices, texel + 2),
+                texelFetch(finalBonesMatrices, texel + 3));
+}
+
 void main() {
+    vec3 morphedPos = pos;
+    vec3 morphedNormal = octDecode(packedNormal);
+    if (hasMorphTargets == 1) {
+        morphedPos += texelFetch(morphPositions, morphTexel(), 0).xyz;
+        morphedNormal += texelFetch(morphNormals, morphTexel(), 0).xyz;
+    }
+
     vec4 totalPosition = vec4(0);
     for (int i = 0; i < MAX_BONE_INFLUENCE; i++) {
-        if (boneIds[i] == -1)
+        if (weights[i] == 0.0)
             continue;
-        if (boneIds[i] >= MAX_BONES) {
-            totalPosition = vec4(pos, 1.0f);
+        int boneId = int(boneIds[i]);
+        if (boneId >= paletteSize) {
+            totalPosition = vec4(morphedPos, 1.0f);
             break;
         }
 
-        vec4 localPosition = finalBonesMatrices[boneIds[i]] * vec4(pos, 1.0f);
+        vec4 localPosition = boneMatrix(boneId) * vec4(morphedPos, 1.0f);
         totalPosition += localPosition * weights[i];
-        vec3 localNormal = mat3(finalBonesMatrices[boneIds[i]]) * normal;
     }
 
     mat4 viewModel = view * model;
     gl_Position = projection * viewModel * totalPosition;
     fragmentTextureCoords = textureCoords;
 
-    fragmentNormal = mat3(transpose(inverse(model))) * normal;
+    fragmentNormal = mat3(transpose(inverse(model))) * morphedNormal;
     fragmentPosition = vec3(model * totalPosition);
 }
@@ -0,0 +1,13 @@
+#version 330 core
+
+in vec3 positionDelta;
+in vec3 normalDelta;
+
+// added onto what earlier targets wrote, blending is GL_ONE, GL_ONE
+layout(location = 0) out vec4 position;
+layout(location = 1) out vec4 normal;
+
+void main() {
+    position = vec4(positionDelta, 0.0f);
+    normal = vec4(normalDelta, 0.0f);
+}
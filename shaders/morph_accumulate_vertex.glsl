@@ -0,0 +1,28 @@
+#version 330 core
+
+// two texels per stored vertex: position delta with the vertex index in w,
+// then the normal delta
+uniform samplerBuffer deltas;
+uniform int firstDelta;
+uniform float weight;
+
+// layout of the accumulated textures, one texel per vertex
+uniform int width;
+uniform vec2 targetSize;
+
+out vec3 positionDelta;
+out vec3 normalDelta;
+
+void main() {
+    int entry = (firstDelta + gl_VertexID) * 2;
+    vec4 position = texelFetch(deltas, entry);
+    vec4 normal = texelFetch(deltas, entry + 1);
+
+    // one point on the texel of the vertex it moves
+    int vertex = int(position.w);
+    vec2 texel = vec2(vertex % width, vertex / width) + 0.5f;
+    gl_Position = vec4(texel / targetSize * 2.0f - 1.0f, 0.0f, 1.0f);
+
+    positionDelta = position.xyz * weight;
+    normalDelta = normal.xyz * weight;
+}
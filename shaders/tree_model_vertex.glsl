@@ -1,7 +1,7 @@
 #version 330 core
 
 layout(location = 0) in vec3 position;
-layout(location = 1) in vec3 normal;
+layout(location = 1) in vec2 packedNormal;
 layout(location = 2) in vec2 textureCoords;
 
 uniform mat4 model;
@@ -12,8 +12,17 @@ out vec3 fragmentPosition;
 out vec3 fragmentNormal;
 out vec2 fragmentTextureCoord;
 
+// normals arrive octahedral encoded (see VertexFormat in vertex_format.hpp)
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
 void main() {
-    fragmentNormal = mat3(transpose(inverse(model))) * normal;
+    fragmentNormal = mat3(transpose(inverse(model))) * octDecode(packedNormal);
     fragmentPosition = vec3(model * vec4(position, 1.0f));
     fragmentTextureCoord = textureCoords;
     gl_Position = projection * view * vec4(fragmentPosition, 1.0f);
@@ -1,8 +1,18 @@
+#ifndef ANIMATION_HPP
+#define ANIMATION_HPP
+
+#include <algorithm>
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "model.hpp"
+#include "pose.hpp"
 
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
@@ -13,29 +23,49 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
-struct KeyPosition {
-  glm::vec3 position;
-  float timeStamp;
-};
-
-struct KeyRotation {
-  glm::quat orientation;
-  float timeStamp;
+/* last key used by each channel of a Bone, so forward playback can resume
+the key search where the previous frame left it */
+struct KeyCursor {
+  int position = 0;
+  int rotation = 0;
+  int scale = 0;
 };
 
-struct KeyScale {
-  glm::vec3 scale;
-  float timeStamp;
+/* the keys either side of a time on each channel of a Bone, and how far
+between them the time falls */
+struct BoneKeyFrames {
+  glm::vec3 position[2];
+  glm::quat rotation[2];
+  glm::vec3 scale[2];
+  float positionFactor;
+  float rotationFactor;
+  float scaleFactor;
 };
 
 class Bone {
 private:
-  std::vector<KeyPosition> m_Positions;
-  std::vector<KeyRotation> m_Rotations;
-  std::vector<KeyScale> m_Scales;
+  // key times live in their own arrays so the key search only touches floats
+  std::vector<float> m_PositionTimes;
+  std::vector<glm::vec3> m_Positions;
+  std::vector<float> m_RotationTimes;
+  std::vector<glm::quat> m_Rotations;
+  std::vector<float> m_ScaleTimes;
+  std::vector<glm::vec3> m_Scales;
+
+  // once compressed the key values above are dropped in favour of these:
+  // translations and scales as 16 bit fractions of the track's range and
+  // rotations as smallest-three quaternions, three uint16_t per key each
+  bool m_Compressed = false;
+  std::vector<uint16_t> m_PackedPositions;
+  std::vector<uint16_t> m_PackedRotations;
+  std::vector<uint16_t> m_PackedScales;
+  glm::vec3 m_PositionMin, m_PositionExtent;
+  glm::vec3 m_ScaleMin, m_ScaleExtent;
+
   int m_NumPositions;
   int m_NumRotations;
   int m_NumScalings;
+  KeyCursor m_Cursor;
 
   glm::mat4 m_LocalTransform;
   std::string m_Name;
@@ -46,44 +76,43 @@ public:
   Bone(const std::string &name, int ID, const aiNodeAnim *channel)
       : m_Name(name), m_ID(ID), m_LocalTransform(1.0f) {
     m_NumPositions = channel->mNumPositionKeys;
-
+    m_PositionTimes.reserve(m_NumPositions);
+    m_Positions.reserve(m_NumPositions);
     for (int positionIndex = 0; positionIndex < m_NumPositions;
          ++positionIndex) {
       aiVector3D aiPosition = channel->mPositionKeys[positionIndex].mValue;
       float timeStamp = channel->mPositionKeys[positionIndex].mTime;
-      KeyPosition data;
-      data.position = GetGLMVec(aiPosition);
-      data.timeStamp = timeStamp;
-      m_Positions.push_back(data);
+      m_PositionTimes.push_back(timeStamp);
+      m_Positions.push_back(GetGLMVec(aiPosition));
     }
 
     m_NumRotations = channel->mNumRotationKeys;
+    m_RotationTimes.reserve(m_NumRotations);
+    m_Rotations.reserve(m_NumRotations);
     for (int rotationIndex = 0; rotationIndex < m_NumRotations;
          ++rotationIndex) {
       aiQuaternion aiOrientation = channel->mRotationKeys[rotationIndex].mValue;
       float timeStamp = channel->mRotationKeys[rotationIndex].mTime;
-      KeyRotation data;
-      data.orientation = GetGLMQuat(aiOrientation);
-      data.timeStamp = timeStamp;
-      m_Rotations.push_back(data);
+      m_RotationTimes.push_back(timeStamp);
+      m_Rotations.push_back(GetGLMQuat(aiOrientation));
     }
 
     m_NumScalings = channel->mNumScalingKeys;
+    m_ScaleTimes.reserve(m_NumScalings);
+    m_Scales.reserve(m_NumScalings);
     for (int keyIndex = 0; keyIndex < m_NumScalings; ++keyIndex) {
       aiVector3D scale = channel->mScalingKeys[keyIndex].mValue;
       float timeStamp = channel->mScalingKeys[keyIndex].mTime;
-      KeyScale data;
-      data.scale = GetGLMVec(scale);
-      data.timeStamp = timeStamp;
-      m_Scales.push_back(data);
+      m_ScaleTimes.push_back(timeStamp);
+      m_Scales.push_back(GetGLMVec(scale));
     }
   }
 
-  glm::vec3 GetGLMVec(const aiVector3D &vec) {
+  glm::vec3 GetGLMVec(const aiVector3D &vec) const {
     return glm::vec3(vec.x, vec.y, vec.z);
   }
 
-  glm::quat GetGLMQuat(const aiQuaternion &pOrientation) {
+  glm::quat GetGLMQuat(const aiQuaternion &pOrientation) const {
     return glm::quat(pOrientation.w, pOrientation.x, pOrientation.y,
                      pOrientation.z);
   }
@@ -92,10 +121,141 @@ public:
   time of the animation and prepares the local transformation matrix by
   combining all keys tranformations*/
   void Update(float animationTime) {
-    glm::mat4 translation = InterpolatePosition(animationTime);
-    glm::mat4 rotation = InterpolateRotation(animationTime);
-    glm::mat4 scale = InterpolateScaling(animationTime);
-    m_LocalTransform = translation * rotation * scale;
+    m_LocalTransform = Sample(animationTime, m_Cursor);
+  }
+
+  /* same as Update, but the key cursor belongs to the caller, so any number
+  of animators can sample one shared Bone at the same time */
+  glm::mat4 Sample(float animationTime, KeyCursor &cursor) const {
+    glm::vec3 position, scale;
+    glm::quat rotation;
+    SampleKeys(animationTime, cursor, position, rotation, scale);
+    glm::mat4 translationMatrix = glm::translate(glm::mat4(1.0f), position);
+    glm::mat4 rotationMatrix = glm::mat4(rotation);
+    glm::mat4 scaleMatrix = glm::scale(glm::mat4(1.0f), scale);
+    return translationMatrix * rotationMatrix * scaleMatrix;
+  }
+
+  /* interpolated translation, rotation and scale at animationTime */
+  void SampleKeys(float animationTime, KeyCursor &cursor, glm::vec3 &position,
+                  glm::quat &rotation, glm::vec3 &scale) const {
+    position = InterpolatePosition(animationTime, cursor.position);
+    rotation = InterpolateRotation(animationTime, cursor.rotation);
+    scale = InterpolateScaling(animationTime, cursor.scale);
+  }
+
+  /* drops keys that interpolating their neighbours reproduces within the
+  given tolerances, then quantizes what is left. rotationTolerance is an
+  angle in radians */
+  void Compress(float positionTolerance, float rotationTolerance,
+                float scaleTolerance) {
+    if (m_Compressed)
+      return;
+
+    auto vec3Error = [](const glm::vec3 &a, const glm::vec3 &b) {
+      return glm::length(a - b);
+    };
+    auto lerp = [](const glm::vec3 &a, const glm::vec3 &b, float t) {
+      return glm::mix(a, b, t);
+    };
+    ReduceKeys(m_PositionTimes, m_Positions, positionTolerance, lerp,
+               vec3Error);
+    ReduceKeys(m_ScaleTimes, m_Scales, scaleTolerance, lerp, vec3Error);
+    ReduceKeys(
+        m_RotationTimes, m_Rotations, rotationTolerance,
+        [](const glm::quat &a, const glm::quat &b, float t) {
+          return Nlerp(a, b, t);
+        },
+        RotationError);
+
+    QuantizeVec3Track(m_Positions, m_PackedPositions, m_PositionMin,
+                      m_PositionExtent);
+    QuantizeVec3Track(m_Scales, m_PackedScales, m_ScaleMin, m_ScaleExtent);
+    m_PackedRotations.resize(m_Rotations.size() * 3);
+    for (int i = 0; i < m_Rotations.size(); i++)
+      PackQuat(m_Rotations[i], &m_PackedRotations[i * 3]);
+
+    m_NumPositions = m_PositionTimes.size();
+    m_NumRotations = m_RotationTimes.size();
+    m_NumScalings = m_ScaleTimes.size();
+    std::vector<glm::vec3>().swap(m_Positions);
+    std::vector<glm::quat>().swap(m_Rotations);
+    std::vector<glm::vec3>().swap(m_Scales);
+    m_Compressed = true;
+  }
+
+  bool IsCompressed() const { return m_Compressed; }
+
+  int GetKeyCount() const {
+    return m_NumPositions + m_NumRotations + m_NumScalings;
+  }
+
+  /* bytes held by key times and values */
+  size_t GetKeyBytes() const {
+    size_t times = sizeof(float) * (m_PositionTimes.size() +
+                                    m_RotationTimes.size() + m_ScaleTimes.size());
+    if (m_Compressed)
+      return times +
+             sizeof(uint16_t) * (m_PackedPositions.size() +
+                                 m_PackedRotations.size() +
+                                 m_PackedScales.size()) +
+             4 * sizeof(glm::vec3);
+    return times + sizeof(glm::vec3) * (m_Positions.size() + m_Scales.size()) +
+           sizeof(glm::quat) * m_Rotations.size();
+  }
+
+  /* the keys around animationTime on every channel, for sampling many
+  bones at once. Single key channels repeat their key with a factor of 0 */
+  void GetKeyFrames(float animationTime, KeyCursor &cursor,
+                    BoneKeyFrames &keys) const {
+    int p0 = 0, p1 = 0;
+    keys.positionFactor = 0.0f;
+    if (m_NumPositions > 1) {
+      p0 = FindKeyIndex(m_PositionTimes, animationTime, cursor.position);
+      p1 = p0 + 1;
+      keys.positionFactor = GetScaleFactor(
+          m_PositionTimes[p0], m_PositionTimes[p1], animationTime);
+    }
+    keys.position[0] = PositionKey(p0);
+    keys.position[1] = PositionKey(p1);
+
+    int r0 = 0, r1 = 0;
+    keys.rotationFactor = 0.0f;
+    if (m_NumRotations > 1) {
+      r0 = FindKeyIndex(m_RotationTimes, animationTime, cursor.rotation);
+      r1 = r0 + 1;
+      keys.rotationFactor = GetScaleFactor(
+          m_RotationTimes[r0], m_RotationTimes[r1], animationTime);
+    }
+    keys.rotation[0] = RotationKey(r0);
+    keys.rotation[1] = RotationKey(r1);
+
+    int s0 = 0, s1 = 0;
+    keys.scaleFactor = 0.0f;
+    if (m_NumScalings > 1) {
+      s0 = FindKeyIndex(m_ScaleTimes, animationTime, cursor.scale);
+      s1 = s0 + 1;
+      keys.scaleFactor =
+          GetScaleFactor(m_ScaleTimes[s0], m_ScaleTimes[s1], animationTime);
+    }
+    keys.scale[0] = ScaleKey(s0);
+    keys.scale[1] = ScaleKey(s1);
+  }
+
+  /* normalized lerp along the shortest arc. Matches the vectorized kernel in
+  MixPoses, and is close enough to slerp between neighbouring keys */
+  static glm::quat Nlerp(const glm::quat &a, glm::quat b, float t) {
+    if (glm::dot(a, b) < 0.0f)
+      b = -b;
+    glm::quat q(a.w + (b.w - a.w) * t, a.x + (b.x - a.x) * t,
+                a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t);
+    return glm::normalize(q);
+  }
+
+  /* angle in radians between two orientations */
+  static float RotationError(const glm::quat &a, const glm::quat &b) {
+    float d = std::min(1.0f, std::abs(glm::dot(a, b)));
+    return 2.0f * std::acos(d);
   }
 
   glm::mat4 GetLocalTransform() { return m_LocalTransform; }
@@ -105,37 +265,45 @@ public:
   /* Gets the current index on mKeyPositions to interpolate to based on
   the current animation time*/
   int GetPositionIndex(float animationTime) {
-    for (int index = 0; index < m_NumPositions - 1; ++index) {
-      if (animationTime < m_Positions[index + 1].timeStamp)
-        return index;
-    }
-    assert(0);
+    return FindKeyIndex(m_PositionTimes, animationTime, m_Cursor.position);
   }
 
   /* Gets the current index on mKeyRotations to interpolate to based on the
   current animation time*/
   int GetRotationIndex(float animationTime) {
-    for (int index = 0; index < m_NumRotations - 1; ++index) {
-      if (animationTime < m_Rotations[index + 1].timeStamp)
-        return index;
-    }
-    assert(0);
+    return FindKeyIndex(m_RotationTimes, animationTime, m_Cursor.rotation);
   }
 
   /* Gets the current index on mKeyScalings to interpolate to based on the
   current animation time */
   int GetScaleIndex(float animationTime) {
-    for (int index = 0; index < m_NumScalings - 1; ++index) {
-      if (animationTime < m_Scales[index + 1].timeStamp)
-        return index;
+    return FindKeyIndex(m_ScaleTimes, animationTime, m_Cursor.scale);
+  }
+
+  /* Finds the last key at or before animationTime. During forward playback
+  the answer is the cached key or the one after it; anything else (seeks,
+  loops, large time steps) falls back to a binary search. Times past the last
+  key clamp to the final pair instead of asserting */
+  static int FindKeyIndex(const std::vector<float> &times, float animationTime,
+                          int &cursor) {
+    int last = static_cast<int>(times.size()) - 2;
+    if (cursor <= last && times[cursor] <= animationTime) {
+      if (animationTime < times[cursor + 1])
+        return cursor;
+      if (cursor + 1 <= last && animationTime < times[cursor + 2])
+        return ++cursor;
     }
-    assert(0);
+
+    auto next =
+        std::upper_bound(times.begin() + 1, times.end() - 1, animationTime);
+    cursor = static_cast<int>(next - times.begin()) - 1;
+    return cursor;
   }
 
 private:
   /* Gets normalized value for Lerp & Slerp*/
   float GetScaleFactor(float lastTimeStamp, float nextTimeStamp,
-                       float animationTime) {
+                       float animationTime) const {
     float scaleFactor = 0.0f;
     float midWayLength = animationTime - lastTimeStamp;
     float framesDiff = nextTimeStamp - lastTimeStamp;
@@ -143,56 +311,182 @@ private:
     return scaleFactor;
   }
 
+  glm::vec3 PositionKey(int index) const {
+    if (m_Compressed)
+      return UnpackVec3(&m_PackedPositions[index * 3], m_PositionMin,
+                        m_PositionExtent);
+    return m_Positions[index];
+  }
+
+  glm::quat RotationKey(int index) const {
+    if (m_Compressed)
+      return UnpackQuat(&m_PackedRotations[index * 3]);
+    return m_Rotations[index];
+  }
+
+  glm::vec3 ScaleKey(int index) const {
+    if (m_Compressed)
+      return UnpackVec3(&m_PackedScales[index * 3], m_ScaleMin, m_ScaleExtent);
+    return m_Scales[index];
+  }
+
   /*figures out which position keys to interpolate b/w and performs the
-  interpolation and returns the translation matrix*/
-  glm::mat4 InterpolatePosition(float animationTime) {
+  interpolation and returns the translation*/
+  glm::vec3 InterpolatePosition(float animationTime, int &cursor) const {
     if (1 == m_NumPositions)
-      return glm::translate(glm::mat4(1.0f), m_Positions[0].position);
+      return PositionKey(0);
 
-    int p0Index = GetPositionIndex(animationTime);
+    int p0Index = FindKeyIndex(m_PositionTimes, animationTime, cursor);
     int p1Index = p0Index + 1;
     float scaleFactor =
-        GetScaleFactor(m_Positions[p0Index].timeStamp,
-                       m_Positions[p1Index].timeStamp, animationTime);
-    glm::vec3 finalPosition =
-        glm::mix(m_Positions[p0Index].position, m_Positions[p1Index].position,
-                 scaleFactor);
-    return glm::translate(glm::mat4(1.0f), finalPosition);
+        GetScaleFactor(m_PositionTimes[p0Index], m_PositionTimes[p1Index],
+                       animationTime);
+    return glm::mix(PositionKey(p0Index), PositionKey(p1Index), scaleFactor);
   }
 
   /*figures out which rotations keys to interpolate b/w and performs the
-  interpolation and returns the rotation matrix*/
-  glm::mat4 InterpolateRotation(float animationTime) {
-    if (1 == m_NumRotations) {
-      auto rotation = glm::normalize(m_Rotations[0].orientation);
-      return glm::mat4(rotation);
-    }
+  interpolation and returns the rotation*/
+  glm::quat InterpolateRotation(float animationTime, int &cursor) const {
+    if (1 == m_NumRotations)
+      return glm::normalize(RotationKey(0));
 
-    int p0Index = GetRotationIndex(animationTime);
+    int p0Index = FindKeyIndex(m_RotationTimes, animationTime, cursor);
     int p1Index = p0Index + 1;
     float scaleFactor =
-        GetScaleFactor(m_Rotations[p0Index].timeStamp,
-                       m_Rotations[p1Index].timeStamp, animationTime);
-    glm::quat finalRotation =
-        glm::slerp(m_Rotations[p0Index].orientation,
-                   m_Rotations[p1Index].orientation, scaleFactor);
-    finalRotation = glm::normalize(finalRotation);
-    // return glm::toMat4(finalRotation);
-    return glm::mat4(finalRotation);
+        GetScaleFactor(m_RotationTimes[p0Index], m_RotationTimes[p1Index],
+                       animationTime);
+    return Nlerp(RotationKey(p0Index), RotationKey(p1Index), scaleFactor);
   }
 
-  glm::mat4 InterpolateScaling(float animationTime) {
+  glm::vec3 InterpolateScaling(float animationTime, int &cursor) const {
     if (1 == m_NumScalings)
-      return glm::scale(glm::mat4(1.0f), m_Scales[0].scale);
+      return ScaleKey(0);
 
-    int p0Index = GetScaleIndex(animationTime);
+    int p0Index = FindKeyIndex(m_ScaleTimes, animationTime, cursor);
     int p1Index = p0Index + 1;
-    float scaleFactor =
-        GetScaleFactor(m_Scales[p0Index].timeStamp, m_Scales[p1Index].timeStamp,
-                       animationTime);
-    glm::vec3 finalScale =
-        glm::mix(m_Scales[p0Index].scale, m_Scales[p1Index].scale, scaleFactor);
-    return glm::scale(glm::mat4(1.0f), finalScale);
+    float scaleFactor = GetScaleFactor(m_ScaleTimes[p0Index],
+                                       m_ScaleTimes[p1Index], animationTime);
+    return glm::mix(ScaleKey(p0Index), ScaleKey(p1Index), scaleFactor);
+  }
+
+  /* greedily keeps the fewest keys such that interpolating between kept keys
+  reproduces every dropped key within tolerance. A track that never moves
+  collapses to a single key */
+  template <typename T, typename Interpolate, typename Error>
+  static void ReduceKeys(std::vector<float> &times, std::vector<T> &values,
+                         float tolerance, Interpolate interpolate,
+                         Error error) {
+    int count = times.size();
+    if (count <= 2) {
+      if (count == 2 && error(values[0], values[1]) <= tolerance) {
+        times.resize(1);
+        values.resize(1);
+      }
+      return;
+    }
+
+    std::vector<int> kept = {0};
+    int anchor = 0;
+    for (int next = 2; next < count; next++) {
+      for (int k = anchor + 1; k < next; k++) {
+        float t = (times[k] - times[anchor]) / (times[next] - times[anchor]);
+        if (error(interpolate(values[anchor], values[next], t), values[k]) >
+            tolerance) {
+          anchor = next - 1;
+          kept.push_back(anchor);
+          break;
+        }
+      }
+    }
+    kept.push_back(count - 1);
+
+    if (kept.size() == 2 && error(values[0], values[count - 1]) <= tolerance)
+      kept.pop_back();
+
+    std::vector<float> keptTimes;
+    std::vector<T> keptValues;
+    for (int index : kept) {
+      keptTimes.push_back(times[index]);
+      keptValues.push_back(values[index]);
+    }
+    times.swap(keptTimes);
+    values.swap(keptValues);
+  }
+
+  static void QuantizeVec3Track(const std::vector<glm::vec3> &values,
+                                std::vector<uint16_t> &packed, glm::vec3 &min,
+                                glm::vec3 &extent) {
+    min = glm::vec3(0.0f);
+    glm::vec3 max(0.0f);
+    if (!values.empty())
+      min = max = values[0];
+    for (const glm::vec3 &value : values) {
+      min = glm::min(min, value);
+      max = glm::max(max, value);
+    }
+    extent = max - min;
+
+    packed.resize(values.size() * 3);
+    for (int i = 0; i < values.size(); i++) {
+      for (int c = 0; c < 3; c++) {
+        float t = extent[c] > 0.0f ? (values[i][c] - min[c]) / extent[c] : 0.0f;
+        packed[i * 3 + c] = static_cast<uint16_t>(std::round(t * 65535.0f));
+      }
+    }
+  }
+
+  static glm::vec3 UnpackVec3(const uint16_t *packed, const glm::vec3 &min,
+                              const glm::vec3 &extent) {
+    return min + extent * glm::vec3(packed[0], packed[1], packed[2]) *
+                     (1.0f / 65535.0f);
+  }
+
+  /* smallest three: the largest component is dropped (and made positive by
+  flipping the sign of the whole quaternion) since it can be rebuilt from the
+  other three. Those lie within +-1/sqrt(2) and get 15 bits each; the two
+  spare bits record which component was dropped */
+  static void PackQuat(glm::quat q, uint16_t *packed) {
+    q = glm::normalize(q);
+    int largest = 0;
+    for (int i = 1; i < 4; i++)
+      if (std::abs(q[i]) > std::abs(q[largest]))
+        largest = i;
+    if (q[largest] < 0.0f)
+      q = -q;
+
+    const float range = 0.70710678f;
+    uint64_t bits = largest;
+    for (int i = 0, shift = 2; i < 4; i++) {
+      if (i == largest)
+        continue;
+      float t = (glm::clamp(q[i], -range, range) + range) / (2.0f * range);
+      bits |= static_cast<uint64_t>(std::round(t * 32767.0f)) << shift;
+      shift += 15;
+    }
+    packed[0] = bits & 0xffff;
+    packed[1] = (bits >> 16) & 0xffff;
+    packed[2] = (bits >> 32) & 0xffff;
+  }
+
+  static glm::quat UnpackQuat(const uint16_t *packed) {
+    uint64_t bits = static_cast<uint64_t>(packed[0]) |
+                    static_cast<uint64_t>(packed[1]) << 16 |
+                    static_cast<uint64_t>(packed[2]) << 32;
+    int largest = bits & 3;
+
+    const float range = 0.70710678f;
+    glm::quat q;
+    float sum = 0.0f;
+    for (int i = 0, shift = 2; i < 4; i++) {
+      if (i == largest)
+        continue;
+      float t = ((bits >> shift) & 0x7fff) / 32767.0f;
+      q[i] = t * 2.0f * range - range;
+      sum += q[i] * q[i];
+      shift += 15;
+    }
+    q[largest] = std::sqrt(std::max(0.0f, 1.0f - sum));
+    return q;
   }
 };
 
@@ -203,20 +497,192 @@ struct AssimpNodeData {
   std::vector<AssimpNodeData> children;
 };
 
+/* a node of the hierarchy baked into a flat array at load. Parents always come
+before their children, so the skeleton is evaluated in one forward pass */
+struct SkeletonNode {
+  glm::mat4 transformation;
+  glm::mat4 offset;
+  int parent;       // -1 for the root
+  int paletteIndex; // slot in the final bone matrices, -1 if not skinned
+  int height;       // longest path down to a leaf, 0 for leaves
+};
+
+/* the part of a character that every clip shares: the node hierarchy, each
+node's palette slot and bind offset, and the rest pose. Clips imported
+together hold one Skeleton between them and only add their own keys */
+class Skeleton {
+public:
+  /* flattens the hierarchy under root depth first. boneInfoMap must already
+  hold every bone any clip animates */
+  Skeleton(const aiNode *root, const std::map<std::string, BoneInfo> &boneInfoMap)
+      : m_BoneInfoMap(boneInfoMap) {
+    ReadHeirarchyData(m_RootNode, root);
+    AppendNode(m_RootNode, -1);
+
+    m_PaletteSize = 0;
+    for (const SkeletonNode &node : m_Nodes)
+      m_PaletteSize = std::max(m_PaletteSize, node.paletteIndex + 1);
+
+    // children come after their parent, so walking backwards finishes every
+    // child before its parent is read
+    for (int i = m_Nodes.size() - 1; i > 0; i--) {
+      SkeletonNode &parent = m_Nodes[m_Nodes[i].parent];
+      parent.height = std::max(parent.height, m_Nodes[i].height + 1);
+    }
+
+    // nodes without keys keep their transformation, split into TRS so they
+    // can be blended like animated ones
+    m_BindPose.resize(m_Nodes.size());
+    for (int i = 0; i < m_Nodes.size(); i++) {
+      const glm::mat4 &m = m_Nodes[i].transformation;
+      glm::vec3 scale(glm::length(glm::vec3(m[0])), glm::length(glm::vec3(m[1])),
+                      glm::length(glm::vec3(m[2])));
+      glm::mat3 rotation(glm::vec3(m[0]) / scale.x, glm::vec3(m[1]) / scale.y,
+                         glm::vec3(m[2]) / scale.z);
+      m_BindPose.set(i, glm::vec3(m[3]), glm::normalize(glm::quat_cast(rotation)),
+                     scale);
+    }
+  }
+
+  /* index of the node called name, -1 if there is none */
+  int FindNode(const std::string &name) const {
+    auto node = m_NodeIndices.find(name);
+    return node == m_NodeIndices.end() ? -1 : node->second;
+  }
+
+  inline const std::vector<SkeletonNode> &GetNodes() const { return m_Nodes; }
+
+  inline int GetNodeCount() const { return m_Nodes.size(); }
+
+  inline int GetPaletteSize() const { return m_PaletteSize; }
+
+  /* whether poses of this skeleton and other can be blended node by node:
+  the same hierarchy with every node in the same palette slot. Clips loaded
+  from separate files of one rig each have their own Skeleton */
+  bool IsCompatible(const Skeleton &other) const {
+    if (this == &other)
+      return true;
+    if (m_Nodes.size() != other.m_Nodes.size())
+      return false;
+    for (size_t i = 0; i < m_Nodes.size(); i++)
+      if (m_Nodes[i].parent != other.m_Nodes[i].parent ||
+          m_Nodes[i].paletteIndex != other.m_Nodes[i].paletteIndex)
+        return false;
+    return true;
+  }
+
+  inline const LocalPose &GetBindPose() const { return m_BindPose; }
+
+  inline const AssimpNodeData &GetRootNode() const { return m_RootNode; }
+
+  inline const std::map<std::string, BoneInfo> &GetBoneIDMap() const {
+    return m_BoneInfoMap;
+  }
+
+private:
+  AssimpNodeData m_RootNode;
+  std::vector<SkeletonNode> m_Nodes;
+  std::unordered_map<std::string, int> m_NodeIndices;
+  std::map<std::string, BoneInfo> m_BoneInfoMap;
+  LocalPose m_BindPose;
+  int m_PaletteSize;
+
+  void AppendNode(const AssimpNodeData &src, int parent) {
+    SkeletonNode node;
+    node.transformation = src.transformation;
+    node.offset = glm::mat4(1.0f);
+    node.parent = parent;
+    node.paletteIndex = -1;
+    node.height = 0;
+
+    auto boneInfo = m_BoneInfoMap.find(src.name);
+    if (boneInfo != m_BoneInfoMap.end()) {
+      node.paletteIndex = boneInfo->second.id;
+      node.offset = boneInfo->second.offset;
+    }
+
+    int index = m_Nodes.size();
+    m_Nodes.push_back(node);
+    m_NodeIndices.emplace(src.name, index);
+    for (int i = 0; i < src.childrenCount; i++)
+      AppendNode(src.children[i], index);
+  }
+
+  void ReadHeirarchyData(AssimpNodeData &dest, const aiNode *src) {
+    assert(src);
+
+    dest.name = src->mName.data;
+    dest.transformation = ConvertMatrixToGLMFormat(src->mTransformation);
+    dest.childrenCount = src->mNumChildren;
+
+    for (int i = 0; i < src->mNumChildren; i++) {
+      AssimpNodeData newData;
+      ReadHeirarchyData(newData, src->mChildren[i]);
+      dest.children.push_back(newData);
+    }
+  }
+
+  static glm::mat4 ConvertMatrixToGLMFormat(const aiMatrix4x4 &from) {
+    glm::mat4 to;
+    to[0][0] = from.a1;
+    to[1][0] = from.a2;
+    to[2][0] = from.a3;
+    to[3][0] = from.a4;
+    to[0][1] = from.b1;
+    to[1][1] = from.b2;
+    to[2][1] = from.b3;
+    to[3][1] = from.b4;
+    to[0][2] = from.c1;
+    to[1][2] = from.c2;
+    to[2][2] = from.c3;
+    to[3][2] = from.c4;
+    to[0][3] = from.d1;
+    to[1][3] = from.d2;
+    to[2][3] = from.d3;
+    to[3][3] = from.d4;
+    return to;
+  }
+};
+
+/* error bounds used when compressing a clip */
+struct ClipCompressionSettings {
+  float positionTolerance = 0.001f; // model units
+  float rotationTolerance = 0.001f; // radians
+  float scaleTolerance = 0.001f;
+};
+
+/* what compressing a clip saved and what it cost */
+struct ClipCompressionReport {
+  size_t bytesBefore = 0;
+  size_t bytesAfter = 0;
+  int keysBefore = 0;
+  int keysAfter = 0;
+  float maxJointError = 0.0f;    // model space distance over sampled poses
+  float maxRotationError = 0.0f; // radians, per bone local rotation
+};
+
 class Animation {
 public:
   Animation() = default;
 
+  /* loads the first clip in animationPath onto model. Use an
+  AnimationLibrary when the model and its clips come from the same file */
   Animation(std::string animationPath, Model *model) {
     Assimp::Importer importer;
     const aiScene *scene =
         importer.ReadFile(animationPath, aiProcess_Triangulate);
     assert(scene && scene->mRootNode);
     auto animation = scene->mAnimations[0];
-    m_Duration = animation->mDuration;
-    m_TicksPerSecond = animation->mTicksPerSecond;
-    ReadHeirarchyData(m_RootNode, scene->mRootNode);
     ReadMissingBones(animation, *model);
+    ReadClip(animation, std::make_shared<Skeleton>(scene->mRootNode,
+                                                   model->get_bone_info_map()));
+  }
+
+  /* reads the keys of animation onto a skeleton shared with other clips. The
+  skeleton's bone map must already know every channel animation has */
+  Animation(const aiAnimation *animation,
+            std::shared_ptr<const Skeleton> skeleton) {
+    ReadClip(animation, std::move(skeleton));
   }
 
   ~Animation() {}
@@ -236,76 +702,281 @@ public:
 
   inline float GetDuration() { return m_Duration; }
 
-  inline const AssimpNodeData &GetRootNode() { return m_RootNode; }
+  inline const std::string &GetName() const { return m_Name; }
 
-  inline const std::map<std::string, BoneInfo> &GetBoneIDMap() {
-    return m_BoneInfoMap;
+  inline const AssimpNodeData &GetRootNode() { return m_Skeleton->GetRootNode(); }
+
+  inline const std::vector<SkeletonNode> &GetNodes() {
+    return m_Skeleton->GetNodes();
   }
 
-private:
-  void ReadMissingBones(const aiAnimation *animation, Model &model) {
-    int size = animation->mNumChannels;
+  inline const std::shared_ptr<const Skeleton> &GetSkeleton() const {
+    return m_Skeleton;
+  }
 
-    auto &boneInfoMap =
-        model.get_bone_info_map(); // getting m_BoneInfoMap from Model class
-    int boneCount =
-        model.bone_count(); // getting the m_BoneCounter from Model class
+  inline Bone &GetBone(int index) { return m_Bones[index]; }
 
-    // reading channels(bones engaged in an animation and their keyframes)
-    for (int i = 0; i < size; i++) {
-      auto channel = animation->mChannels[i];
-      std::string boneName = channel->mNodeName.data;
+  inline int GetBoneCount() const { return m_Bones.size(); }
 
-      if (boneInfoMap.find(boneName) == boneInfoMap.end()) {
-        boneInfoMap[boneName].id = boneCount;
-        boneCount++;
+  inline int GetNodeCount() const { return m_Skeleton->GetNodeCount(); }
+
+  /* compresses every bone in place and measures the resulting pose error by
+  sampling the clip before and after at several points per key */
+  ClipCompressionReport Compress(const ClipCompressionSettings &settings) {
+    ClipCompressionReport report;
+    Animation original = *this;
+
+    int maxKeys = 0;
+    for (Bone &bone : m_Bones) {
+      report.bytesBefore += bone.GetKeyBytes();
+      report.keysBefore += bone.GetKeyCount();
+      maxKeys = std::max(maxKeys, bone.GetKeyCount());
+      bone.Compress(settings.positionTolerance, settings.rotationTolerance,
+                    settings.scaleTolerance);
+      report.bytesAfter += bone.GetKeyBytes();
+      report.keysAfter += bone.GetKeyCount();
+    }
+
+    int samples = std::max(2, 4 * maxKeys);
+    std::vector<KeyCursor> cursorsBefore(m_Bones.size());
+    std::vector<KeyCursor> cursorsAfter(m_Bones.size());
+    std::vector<glm::mat4> globalsBefore(GetNodeCount());
+    std::vector<glm::mat4> globalsAfter(GetNodeCount());
+    std::vector<glm::mat4> palette(GetPaletteSize());
+    for (int i = 0; i < samples; i++) {
+      float time = m_Duration * i / (samples - 1);
+      original.Evaluate(time, cursorsBefore.data(), globalsBefore.data(),
+                        palette.data());
+      Evaluate(time, cursorsAfter.data(), globalsAfter.data(), palette.data());
+      for (int n = 0; n < GetNodeCount(); n++) {
+        glm::vec3 before(globalsBefore[n][3]);
+        glm::vec3 after(globalsAfter[n][3]);
+        report.maxJointError =
+            std::max(report.maxJointError, glm::length(before - after));
+      }
+
+      for (int b = 0; b < m_Bones.size(); b++) {
+        glm::vec3 position, scale;
+        glm::quat before, after;
+        original.m_Bones[b].SampleKeys(time, cursorsBefore[b], position, before,
+                                       scale);
+        m_Bones[b].SampleKeys(time, cursorsAfter[b], position, after, scale);
+        report.maxRotationError = std::max(report.maxRotationError,
+                                           Bone::RotationError(before, after));
       }
-      m_Bones.push_back(Bone(channel->mNodeName.data,
-                             boneInfoMap[channel->mNodeName.data].id, channel));
     }
+    return report;
+  }
+
+  // number of final bone matrices this clip writes
+  inline int GetPaletteSize() const { return m_Skeleton->GetPaletteSize(); }
 
-    m_BoneInfoMap = boneInfoMap;
+  /* samples the clip at animationTime and writes the final bone matrices to
+  palette. cursors (one per bone) and globals (one per node) are owned by the
+  caller, so a shared Animation holds no per-instance state and can be
+  evaluated from several threads at once. Bones closer to a leaf than
+  minSampledHeight (fingers, toes) are left in their bind pose. Returns the
+  number of bones sampled */
+  int Evaluate(float animationTime, KeyCursor *cursors, glm::mat4 *globals,
+               glm::mat4 *palette, int minSampledHeight = 0) const {
+    thread_local LocalPose pose;
+    int sampled = SamplePose(animationTime, cursors, pose, minSampledHeight);
+    ComputePalette(pose, globals, palette);
+    return sampled;
   }
 
-  glm::mat4 ConvertMatrixToGLMFormat(const aiMatrix4x4 &from) {
-    glm::mat4 to;
-    to[0][0] = from.a1;
-    to[1][0] = from.a2;
-    to[2][0] = from.a3;
-    to[3][0] = from.a4;
-    to[0][1] = from.b1;
-    to[1][1] = from.b2;
-    to[2][1] = from.b3;
-    to[3][1] = from.b4;
-    to[0][2] = from.c1;
-    to[1][2] = from.c2;
-    to[2][2] = from.c3;
-    to[3][2] = from.c4;
-    to[0][3] = from.d1;
-    to[1][3] = from.d2;
-    to[2][3] = from.d3;
-    to[3][3] = from.d4;
-    return to;
+  /* samples every node's local transform at animationTime. Key lookups are
+  per bone, the interpolation itself runs four nodes at a time */
+  int SamplePose(float animationTime, KeyCursor *cursors, LocalPose &pose,
+                 int minSampledHeight = 0) const {
+    thread_local LocalPose from, to;
+    thread_local std::vector<float> positionWeights, rotationWeights,
+        scaleWeights;
+    const LocalPose &bindPose = m_Skeleton->GetBindPose();
+    from = bindPose;
+    to = bindPose;
+    positionWeights.assign(bindPose.padded(), 0.0f);
+    rotationWeights.assign(bindPose.padded(), 0.0f);
+    scaleWeights.assign(bindPose.padded(), 0.0f);
+
+    const std::vector<SkeletonNode> &nodes = m_Skeleton->GetNodes();
+    int sampled = 0;
+    BoneKeyFrames keys;
+    for (int i = 0; i < nodes.size(); i++) {
+      int bone = m_NodeBones[i];
+      if (bone == -1 || nodes[i].height < minSampledHeight)
+        continue;
+
+      m_Bones[bone].GetKeyFrames(animationTime, cursors[bone], keys);
+      from.set(i, keys.position[0], keys.rotation[0], keys.scale[0]);
+      to.set(i, keys.position[1], keys.rotation[1], keys.scale[1]);
+      positionWeights[i] = keys.positionFactor;
+      rotationWeights[i] = keys.rotationFactor;
+      scaleWeights[i] = keys.scaleFactor;
+      sampled++;
+    }
+
+    MixPoses(from, to, positionWeights.data(), rotationWeights.data(),
+             scaleWeights.data(), pose);
+    return sampled;
   }
 
-  void ReadHeirarchyData(AssimpNodeData &dest, const aiNode *src) {
-    assert(src);
+  /* global transforms of every node, then the final bone matrices */
+  void ComputePalette(const LocalPose &pose, glm::mat4 *globals,
+                      glm::mat4 *palette) const {
+    ComputeGlobals(pose, globals);
+    ComputeSkinMatrices(globals, palette);
+  }
 
-    dest.name = src->mName.data;
-    dest.transformation = ConvertMatrixToGLMFormat(src->mTransformation);
-    dest.childrenCount = src->mNumChildren;
+  /* converts a local pose to one matrix per node, then walks the flattened
+  skeleton once. Parents come before their children, so each node only
+  needs its parent's global transform */
+  void ComputeGlobals(const LocalPose &pose, glm::mat4 *globals) const {
+    const std::vector<SkeletonNode> &nodes = m_Skeleton->GetNodes();
+    for (int i = 0; i < nodes.size(); i++) {
+      glm::mat4 nodeTransform = pose.matrix(i);
+      if (nodes[i].parent == -1)
+        globals[i] = nodeTransform;
+      else
+        globals[i] = globals[nodes[i].parent] * nodeTransform;
+    }
+  }
 
-    for (int i = 0; i < src->mNumChildren; i++) {
-      AssimpNodeData newData;
-      ReadHeirarchyData(newData, src->mChildren[i]);
-      dest.children.push_back(newData);
+  /* global transform times bind offset for every skinned node */
+  void ComputeSkinMatrices(const glm::mat4 *globals, glm::mat4 *palette) const {
+    const std::vector<SkeletonNode> &nodes = m_Skeleton->GetNodes();
+    for (int i = 0; i < nodes.size(); i++) {
+      if (nodes[i].paletteIndex != -1)
+        palette[nodes[i].paletteIndex] = globals[i] * nodes[i].offset;
+    }
+  }
+
+  inline const std::map<std::string, BoneInfo> &GetBoneIDMap() {
+    return m_Skeleton->GetBoneIDMap();
+  }
+
+  /* gives every channel of animation that model doesn't skin a palette slot
+  of its own, so clips can animate helper nodes the mesh never references */
+  static void ReadMissingBones(const aiAnimation *animation, Model &model) {
+    auto &boneInfoMap = model.get_bone_info_map();
+    for (int i = 0; i < animation->mNumChannels; i++) {
+      std::string boneName = animation->mChannels[i]->mNodeName.data;
+      if (boneInfoMap.find(boneName) == boneInfoMap.end()) {
+        BoneInfo info;
+        info.id = boneInfoMap.size();
+        info.offset = glm::mat4(1.0f);
+        boneInfoMap[boneName] = info;
+      }
+    }
+  }
+
+private:
+  void ReadClip(const aiAnimation *animation,
+                std::shared_ptr<const Skeleton> skeleton) {
+    m_Name = animation->mName.C_Str();
+    m_Duration = animation->mDuration;
+    // formats without a tick rate report 0; those clips play at the rate
+    // Assimp itself assumes for them
+    m_TicksPerSecond = animation->mTicksPerSecond >= 1.0
+                           ? (int)animation->mTicksPerSecond
+                           : DefaultTicksPerSecond;
+    m_Skeleton = std::move(skeleton);
+
+    const std::map<std::string, BoneInfo> &boneInfoMap =
+        m_Skeleton->GetBoneIDMap();
+    m_NodeBones.assign(m_Skeleton->GetNodeCount(), -1);
+    for (int i = 0; i < animation->mNumChannels; i++) {
+      auto channel = animation->mChannels[i];
+      std::string boneName = channel->mNodeName.data;
+      auto boneInfo = boneInfoMap.find(boneName);
+      if (boneInfo == boneInfoMap.end()) {
+        std::ostringstream error_message;
+        error_message << "Animation " << m_Name << " animates bone " << boneName
+                      << " that its skeleton has no slot for.";
+        throw std::logic_error(error_message.str());
+      }
+
+      // channels for nodes outside the hierarchy are kept but never sampled
+      int node = m_Skeleton->FindNode(boneName);
+      if (node != -1)
+        m_NodeBones[node] = m_Bones.size();
+      m_Bones.push_back(Bone(boneName, boneInfo->second.id, channel));
     }
   }
+
+  static constexpr int DefaultTicksPerSecond = 25;
+
+  std::string m_Name;
   float m_Duration;
-  int m_TicksPerSecond;
+  int m_TicksPerSecond; // never 0, see ReadClip
   std::vector<Bone> m_Bones;
-  AssimpNodeData m_RootNode;
-  std::map<std::string, BoneInfo> m_BoneInfoMap;
+  std::shared_ptr<const Skeleton> m_Skeleton;
+  // channel in m_Bones animating each skeleton node, -1 if none
+  std::vector<int> m_NodeBones;
+};
+
+/* a character's model and every clip in its file, read with a single import.
+Clips share one Skeleton and can be looked up by index or by name */
+class AnimationLibrary {
+public:
+  /* reads the clips in scene onto model, which must have been built from the
+  same scene */
+  AnimationLibrary(const aiScene *scene, Model &model) {
+    // register every clip's bones first so the shared skeleton has them all
+    for (int i = 0; i < scene->mNumAnimations; i++)
+      Animation::ReadMissingBones(scene->mAnimations[i], model);
+    m_Skeleton =
+        std::make_shared<Skeleton>(scene->mRootNode, model.get_bone_info_map());
+
+    // reserved up front, clips are handed out by pointer and must not move
+    m_Clips.reserve(scene->mNumAnimations);
+    for (int i = 0; i < scene->mNumAnimations; i++) {
+      m_Clips.emplace_back(scene->mAnimations[i], m_Skeleton);
+      m_Indices.emplace(m_Clips.back().GetName(), i);
+    }
+  }
+
+  AnimationLibrary(const AnimationLibrary &) = delete;
+  AnimationLibrary &operator=(const AnimationLibrary &) = delete;
+
+  Animation *Get(int index) {
+    if (index < 0 || index >= m_Clips.size()) {
+      std::ostringstream error_message;
+      error_message << "No animation clip " << index << ", the library has "
+                    << m_Clips.size() << ".";
+      throw std::logic_error(error_message.str());
+    }
+    return &m_Clips[index];
+  }
+
+  Animation *Get(const std::string &name) {
+    auto index = m_Indices.find(name);
+    if (index == m_Indices.end()) {
+      std::ostringstream error_message;
+      error_message << "No animation clip named: " << name;
+      throw std::logic_error(error_message.str());
+    }
+    return &m_Clips[index->second];
+  }
+
+  // -1 if no clip is called name
+  int FindClip(const std::string &name) const {
+    auto index = m_Indices.find(name);
+    return index == m_Indices.end() ? -1 : index->second;
+  }
+
+  int GetClipCount() const { return m_Clips.size(); }
+
+  std::vector<Animation> &GetClips() { return m_Clips; }
+
+  const std::shared_ptr<const Skeleton> &GetSkeleton() const {
+    return m_Skeleton;
+  }
+
+private:
+  std::shared_ptr<const Skeleton> m_Skeleton;
+  std::vector<Animation> m_Clips;
+  std::unordered_map<std::string, int> m_Indices;
 };
 
 class Animator {
@@ -313,6 +984,10 @@ public:
   Animator(Animation *animation) {
     m_CurrentTime = 0.0;
     m_CurrentAnimation = animation;
+    m_PreviousAnimation = nullptr;
+    m_PreviousTime = 0.0f;
+    m_FadeTime = 0.0f;
+    m_FadeDuration = 0.0f;
 
     m_FinalBoneMatrices.reserve(100);
 
@@ -323,48 +998,86 @@ public:
   void UpdateAnimation(float dt) {
     m_DeltaTime = dt;
     if (m_CurrentAnimation) {
-      m_CurrentTime += m_CurrentAnimation->GetTicksPerSecond() * dt;
-      m_CurrentTime = fmod(m_CurrentTime, m_CurrentAnimation->GetDuration());
-      CalculateBoneTransform(&m_CurrentAnimation->GetRootNode(),
-                             glm::mat4(1.0f));
+      m_CurrentTime = Advance(m_CurrentAnimation, m_CurrentTime, dt);
+      if (m_PreviousAnimation) {
+        m_PreviousTime = Advance(m_PreviousAnimation, m_PreviousTime, dt);
+        m_FadeTime += dt;
+        if (m_FadeTime >= m_FadeDuration)
+          m_PreviousAnimation = nullptr;
+      }
+      CalculateBoneTransforms();
     }
   }
 
   void PlayAnimation(Animation *pAnimation) {
     m_CurrentAnimation = pAnimation;
     m_CurrentTime = 0.0f;
+    m_PreviousAnimation = nullptr;
   }
 
-  void CalculateBoneTransform(const AssimpNodeData *node,
-                              glm::mat4 parentTransform) {
-    std::string nodeName = node->name;
-    glm::mat4 nodeTransform = node->transformation;
-
-    Bone *Bone = m_CurrentAnimation->FindBone(nodeName);
-
-    if (Bone) {
-      Bone->Update(m_CurrentTime);
-      nodeTransform = Bone->GetLocalTransform();
+  /* starts pAnimation and blends over from the current pose across duration
+  seconds. Clips must share a skeleton to blend; otherwise this is a cut */
+  void CrossFade(Animation *pAnimation, float duration) {
+    if (!m_CurrentAnimation || duration <= 0.0f ||
+        !pAnimation->GetSkeleton()->IsCompatible(
+            *m_CurrentAnimation->GetSkeleton())) {
+      PlayAnimation(pAnimation);
+      return;
     }
 
-    glm::mat4 globalTransformation = parentTransform * nodeTransform;
+    m_PreviousAnimation = m_CurrentAnimation;
+    m_PreviousTime = m_CurrentTime;
+    m_PreviousCursors.swap(m_Cursors);
+    m_CurrentAnimation = pAnimation;
+    m_CurrentTime = 0.0f;
+    m_Cursors.clear();
+    m_FadeTime = 0.0f;
+    m_FadeDuration = duration;
+  }
 
-    auto boneInfoMap = m_CurrentAnimation->GetBoneIDMap();
-    if (boneInfoMap.find(nodeName) != boneInfoMap.end()) {
-      int index = boneInfoMap[nodeName].id;
-      glm::mat4 offset = boneInfoMap[nodeName].offset;
-      m_FinalBoneMatrices[index] = globalTransformation * offset;
-    }
+  /* samples the current clip (and the one being faded out, if any) into
+  local poses, blends them, and converts the result to the final palette */
+  void CalculateBoneTransforms() {
+    int paletteSize = m_CurrentAnimation->GetPaletteSize();
+    if (m_FinalBoneMatrices.size() < paletteSize)
+      m_FinalBoneMatrices.resize(paletteSize, glm::mat4(1.0f));
+    m_Cursors.resize(m_CurrentAnimation->GetBoneCount());
+    m_GlobalTransforms.resize(m_CurrentAnimation->GetNodeCount());
 
-    for (int i = 0; i < node->childrenCount; i++)
-      CalculateBoneTransform(&node->children[i], globalTransformation);
+    m_CurrentAnimation->SamplePose(m_CurrentTime, m_Cursors.data(), m_Pose);
+    if (m_PreviousAnimation) {
+      m_PreviousCursors.resize(m_PreviousAnimation->GetBoneCount());
+      m_PreviousAnimation->SamplePose(m_PreviousTime, m_PreviousCursors.data(),
+                                      m_PreviousPose);
+      BlendPoses(m_PreviousPose, m_Pose, m_FadeTime / m_FadeDuration, m_Pose);
+    }
+    m_CurrentAnimation->ComputePalette(m_Pose, m_GlobalTransforms.data(),
+                                       m_FinalBoneMatrices.data());
   }
 
   std::vector<glm::mat4>& GetFinalBoneMatrices() { return m_FinalBoneMatrices; }
 
 private:
   std::vector<glm::mat4> m_FinalBoneMatrices;
+  std::vector<glm::mat4> m_GlobalTransforms;
+  std::vector<KeyCursor> m_Cursors;
+  LocalPose m_Pose;
   Animation *m_CurrentAnimation;
   float m_CurrentTime;
   float m_DeltaTime;
+
+  // clip being faded out by CrossFade
+  Animation *m_PreviousAnimation;
+  std::vector<KeyCursor> m_PreviousCursors;
+  LocalPose m_PreviousPose;
+  float m_PreviousTime;
+  float m_FadeTime;
+  float m_FadeDuration;
+
+  static float Advance(Animation *animation, float time, float dt) {
+    time += animation->GetTicksPerSecond() * dt;
+    return fmod(time, animation->GetDuration());
+  }
 };
+
+#endif
@@ -0,0 +1,406 @@
+#ifndef ANIMATION_SYSTEM_HPP
+#define ANIMATION_SYSTEM_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "animation.hpp"
+#include "camera.hpp"
+#include "thread_pool.hpp"
+
+/* animation level of detail. Tier t re-evaluates every 2^t frames and keeps
+its last palette in between; the last tier also leaves bones near the leaves
+in bind pose. Instances outside the view are evaluated like the last tier,
+but only every culledInterval frames, so the bounds they report back through
+SetBounds keep following the animation and tell when they come into view */
+struct AnimationLodSettings {
+  static constexpr int tierCount = 4;
+  // smallest on-screen size (bounding radius over half the screen height)
+  // for tiers 0, 1 and 2; anything smaller falls into tier 3
+  float screenSizes[tierCount - 1] = {0.15f, 0.06f, 0.025f};
+  // bones closer to a leaf than this are skipped in the last tier
+  int leafSkipHeight = 2;
+  // frames between evaluations of an instance outside the view
+  int culledInterval = 16;
+};
+
+/* per-frame counters, one slot per tier plus one for culled instances */
+struct AnimationLodStats {
+  static constexpr int culled = AnimationLodSettings::tierCount;
+  int instances[AnimationLodSettings::tierCount + 1] = {};
+  int bonesEvaluated[AnimationLodSettings::tierCount + 1] = {};
+  int bonesSaved[AnimationLodSettings::tierCount + 1] = {};
+};
+
+/* hit and miss counts of the pose cache over the last Update */
+struct PoseCacheStats {
+  int hits = 0;
+  int misses = 0;
+  int entries = 0; // poses held in the cache
+};
+
+/* playback state of one animated character. The clip itself is shared, so an
+instance only carries its time, speed and key cursors */
+struct AnimationInstance {
+  Animation *clip;
+  float time;
+  float speed;
+  int paletteOffset;
+  std::vector<KeyCursor> cursors;
+
+  // world space bounding sphere, used to pick the LOD tier
+  glm::vec3 center;
+  float radius;
+  int tier;
+  int lastEvaluatedFrame;
+  int bonesEvaluated;
+};
+
+/* owns every animated character and updates them all in parallel. Final bone
+matrices for all instances live in one contiguous palette, each instance
+owning GetPaletteSize() matrices starting at its offset */
+class AnimationSystem {
+public:
+  AnimationSystem(unsigned int numThreads = std::thread::hardware_concurrency())
+      : m_Pool(numThreads), m_Frame(0), m_PoseCacheStep(0.0f),
+        m_PoseCacheCapacity(256) {}
+
+  /* adds a character playing clip and returns its handle */
+  int AddInstance(Animation *clip, float speed = 1.0f, float startTime = 0.0f) {
+    AnimationInstance instance;
+    instance.clip = clip;
+    instance.time = startTime;
+    instance.speed = speed;
+    instance.paletteOffset = m_Palette.size();
+    instance.cursors.resize(clip->GetBoneCount());
+    instance.center = glm::vec3(0.0f);
+    instance.radius = 0.0f;
+    instance.tier = 0;
+    // spread slower tiers over different frames instead of all at once
+    instance.lastEvaluatedFrame = -1 - int(m_Instances.size() % 8);
+    instance.bonesEvaluated = 0;
+
+    m_Palette.resize(m_Palette.size() + clip->GetPaletteSize(),
+                     glm::mat4(1.0f));
+    m_Instances.push_back(instance);
+    return m_Instances.size() - 1;
+  }
+
+  void SetSpeed(int instance, float speed) {
+    m_Instances[instance].speed = speed;
+  }
+
+  void SetTime(int instance, float time) { m_Instances[instance].time = time; }
+
+  /* world space bounding sphere of the instance, for LOD and culling */
+  void SetBounds(int instance, glm::vec3 center, float radius) {
+    m_Instances[instance].center = center;
+    m_Instances[instance].radius = radius;
+  }
+
+  void SetLodSettings(const AnimationLodSettings &settings) {
+    m_LodSettings = settings;
+  }
+
+  /* shares evaluated poses between instances playing the same clip. Times
+  are snapped down to multiples of step seconds, and every instance landing
+  on the same (clip, snapped time) copies one cached palette instead of
+  evaluating its own. A step of 0 turns the cache off. capacity bounds the
+  number of poses kept; the least recently used one is dropped first */
+  void SetPoseCache(float step, int capacity = 256) {
+    m_PoseCacheStep = step;
+    m_PoseCacheCapacity = std::max(1, capacity);
+    m_PoseCache.clear();
+    m_PoseCacheEntries.clear();
+  }
+
+  /* advances every instance by dt seconds and re-evaluates all of them */
+  void Update(float dt) {
+    for (AnimationInstance &instance : m_Instances)
+      instance.tier = 0;
+    UpdateInstances(dt);
+  }
+
+  /* advances every instance by dt seconds and re-evaluates them according to
+  their LOD tier as seen from camera */
+  void Update(float dt, Camera &camera) {
+    Frustum frustum = camera.frustum();
+    glm::vec3 eye = camera.pos();
+    float tanHalfFov = std::tan(glm::radians(camera.fov()) * 0.5f);
+
+    for (AnimationInstance &instance : m_Instances) {
+      if (!frustum.intersects_sphere(instance.center, instance.radius)) {
+        instance.tier = AnimationLodStats::culled;
+        continue;
+      }
+
+      float distance = glm::length(instance.center - eye);
+      float screenSize =
+          instance.radius / std::max(distance * tanHalfFov, 1e-4f);
+      instance.tier = AnimationLodSettings::tierCount - 1;
+      for (int tier = 0; tier < AnimationLodSettings::tierCount - 1; tier++) {
+        if (screenSize >= m_LodSettings.screenSizes[tier]) {
+          instance.tier = tier;
+          break;
+        }
+      }
+    }
+    UpdateInstances(dt);
+  }
+
+  int GetInstanceCount() const { return m_Instances.size(); }
+
+  int GetBoneCount(int instance) const {
+    return m_Instances[instance].clip->GetPaletteSize();
+  }
+
+  // index of the instance's first matrix in GetPalette()
+  int GetPaletteOffset(int instance) const {
+    return m_Instances[instance].paletteOffset;
+  }
+
+  const glm::mat4 *GetBoneMatrices(int instance) const {
+    return m_Palette.data() + m_Instances[instance].paletteOffset;
+  }
+
+  const std::vector<glm::mat4> &GetPalette() const { return m_Palette; }
+
+  // counters from the last Update
+  const AnimationLodStats &GetLodStats() const { return m_LodStats; }
+
+  const PoseCacheStats &GetPoseCacheStats() const { return m_PoseCacheStats; }
+
+private:
+  // instances per job; large enough to amortise scheduling, small enough to
+  // balance across cores when clips differ in size
+  static constexpr size_t s_Grain = 16;
+
+  // a pose shared between instances: which clip, which time step, and how
+  // much of the skeleton was sampled
+  struct PoseCacheKey {
+    const Animation *clip;
+    int step;
+    int minSampledHeight;
+
+    bool operator==(const PoseCacheKey &other) const {
+      return clip == other.clip && step == other.step &&
+             minSampledHeight == other.minSampledHeight;
+    }
+  };
+
+  struct PoseCacheKeyHash {
+    size_t operator()(const PoseCacheKey &key) const {
+      size_t hash = std::hash<const void *>()(key.clip);
+      hash ^= std::hash<int>()(key.step) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+      hash ^= std::hash<int>()(key.minSampledHeight) + 0x9e3779b9 +
+              (hash << 6) + (hash >> 2);
+      return hash;
+    }
+  };
+
+  struct PoseCacheEntry {
+    PoseCacheKey key;
+    std::vector<glm::mat4> palette;
+    int lastUsedFrame;
+  };
+
+  // an instance evaluated through the cache this frame
+  struct CachedEvaluation {
+    int instance;
+    int entry; // -1 for an instance evaluated straight into its palette
+    bool miss; // the instance evaluates the entry for everyone else
+  };
+
+  std::vector<AnimationInstance> m_Instances;
+  std::vector<glm::mat4> m_Palette;
+  ThreadPool m_Pool;
+  AnimationLodSettings m_LodSettings;
+  AnimationLodStats m_LodStats;
+  int m_Frame;
+
+  float m_PoseCacheStep;
+  int m_PoseCacheCapacity;
+  std::unordered_map<PoseCacheKey, int, PoseCacheKeyHash> m_PoseCache;
+  std::vector<PoseCacheEntry> m_PoseCacheEntries;
+  std::vector<CachedEvaluation> m_CachedEvaluations;
+  PoseCacheStats m_PoseCacheStats;
+
+  void UpdateInstances(float dt) {
+    if (m_PoseCacheStep > 0.0f) {
+      UpdateInstancesCached(dt);
+    } else {
+      m_Pool.parallel_for(m_Instances.size(), s_Grain,
+                          [&](size_t begin, size_t end) {
+                            // node transforms are scratch, reused per thread
+                            thread_local std::vector<glm::mat4> globals;
+                            for (size_t i = begin; i < end; i++)
+                              UpdateInstance(m_Instances[i], dt, globals);
+                          });
+      m_PoseCacheStats = PoseCacheStats();
+    }
+
+    m_LodStats = AnimationLodStats();
+    for (const AnimationInstance &instance : m_Instances) {
+      int fullCost = instance.clip->GetBoneCount();
+      m_LodStats.instances[instance.tier]++;
+      m_LodStats.bonesEvaluated[instance.tier] += instance.bonesEvaluated;
+      m_LodStats.bonesSaved[instance.tier] +=
+          fullCost - instance.bonesEvaluated;
+    }
+    m_Frame++;
+  }
+
+  void UpdateInstance(AnimationInstance &instance, float dt,
+                      std::vector<glm::mat4> &globals) {
+    Advance(instance, dt);
+    instance.bonesEvaluated = 0;
+    if (!IsDue(instance))
+      return;
+
+    Animation *clip = instance.clip;
+    globals.resize(clip->GetNodeCount());
+    instance.bonesEvaluated =
+        clip->Evaluate(instance.time, instance.cursors.data(), globals.data(),
+                       m_Palette.data() + instance.paletteOffset,
+                       MinSampledHeight(instance));
+    instance.lastEvaluatedFrame = m_Frame;
+  }
+
+  /* looks every due instance up in the pose cache on this thread, evaluates
+  the misses in parallel, then copies the cached palettes out in parallel */
+  void UpdateInstancesCached(float dt) {
+    m_PoseCacheStats = PoseCacheStats();
+    m_CachedEvaluations.clear();
+    for (int i = 0; i < m_Instances.size(); i++) {
+      AnimationInstance &instance = m_Instances[i];
+      Advance(instance, dt);
+      instance.bonesEvaluated = 0;
+      if (!IsDue(instance))
+        continue;
+
+      float stepTicks = m_PoseCacheStep * instance.clip->GetTicksPerSecond();
+      if (stepTicks <= 0.0f) {
+        // no steps to share poses at, so this one isn't cached
+        m_CachedEvaluations.push_back({i, -1, true});
+        instance.lastEvaluatedFrame = m_Frame;
+        continue;
+      }
+      PoseCacheKey key = {instance.clip, int(instance.time / stepTicks),
+                          MinSampledHeight(instance)};
+      CachedEvaluation evaluation = {i, 0, false};
+      auto cached = m_PoseCache.find(key);
+      if (cached != m_PoseCache.end()) {
+        evaluation.entry = cached->second;
+        m_PoseCacheStats.hits++;
+      } else {
+        evaluation.entry = AllocatePoseCacheEntry(key);
+        evaluation.miss = true;
+        m_PoseCacheStats.misses++;
+      }
+      m_PoseCacheEntries[evaluation.entry].lastUsedFrame = m_Frame;
+      instance.lastEvaluatedFrame = m_Frame;
+      m_CachedEvaluations.push_back(evaluation);
+    }
+    m_PoseCacheStats.entries = m_PoseCache.size();
+
+    m_Pool.parallel_for(
+        m_CachedEvaluations.size(), s_Grain, [&](size_t begin, size_t end) {
+          thread_local std::vector<glm::mat4> globals;
+          for (size_t i = begin; i < end; i++) {
+            const CachedEvaluation &evaluation = m_CachedEvaluations[i];
+            if (!evaluation.miss)
+              continue;
+            AnimationInstance &instance = m_Instances[evaluation.instance];
+            Animation *clip = instance.clip;
+            globals.resize(clip->GetNodeCount());
+            if (evaluation.entry == -1) {
+              instance.bonesEvaluated = clip->Evaluate(
+                  instance.time, instance.cursors.data(), globals.data(),
+                  m_Palette.data() + instance.paletteOffset,
+                  MinSampledHeight(instance));
+              continue;
+            }
+            PoseCacheEntry &entry = m_PoseCacheEntries[evaluation.entry];
+            // sample at the start of the step so every sharer gets the same
+            float stepTicks = m_PoseCacheStep * clip->GetTicksPerSecond();
+            instance.bonesEvaluated = clip->Evaluate(
+                entry.key.step * stepTicks, instance.cursors.data(),
+                globals.data(), entry.palette.data(),
+                entry.key.minSampledHeight);
+          }
+        });
+
+    m_Pool.parallel_for(
+        m_CachedEvaluations.size(), s_Grain, [&](size_t begin, size_t end) {
+          for (size_t i = begin; i < end; i++) {
+            const CachedEvaluation &evaluation = m_CachedEvaluations[i];
+            if (evaluation.entry == -1)
+              continue;
+            const AnimationInstance &instance = m_Instances[evaluation.instance];
+            const std::vector<glm::mat4> &palette =
+                m_PoseCacheEntries[evaluation.entry].palette;
+            std::copy(palette.begin(), palette.end(),
+                      m_Palette.begin() + instance.paletteOffset);
+          }
+        });
+  }
+
+  /* a cache slot for key, reusing the least recently used one when full.
+  Slots used earlier this frame are never taken back */
+  int AllocatePoseCacheEntry(const PoseCacheKey &key) {
+    int index = m_PoseCacheEntries.size();
+    if (index >= m_PoseCacheCapacity) {
+      index = -1;
+      for (int i = 0; i < m_PoseCacheEntries.size(); i++) {
+        int used = m_PoseCacheEntries[i].lastUsedFrame;
+        if (used != m_Frame &&
+            (index == -1 || used < m_PoseCacheEntries[index].lastUsedFrame))
+          index = i;
+      }
+    }
+
+    if (index == -1 || index == m_PoseCacheEntries.size()) {
+      // not full yet, or every slot is taken by this frame
+      index = m_PoseCacheEntries.size();
+      m_PoseCacheEntries.emplace_back();
+    } else {
+      m_PoseCache.erase(m_PoseCacheEntries[index].key);
+    }
+
+    PoseCacheEntry &entry = m_PoseCacheEntries[index];
+    entry.key = key;
+    entry.palette.resize(key.clip->GetPaletteSize());
+    m_PoseCache[key] = index;
+    return index;
+  }
+
+  // time always advances so a character resumes in step when it returns
+  void Advance(AnimationInstance &instance, float dt) {
+    Animation *clip = instance.clip;
+    instance.time += clip->GetTicksPerSecond() * dt * instance.speed;
+    instance.time = std::fmod(instance.time, clip->GetDuration());
+    if (instance.time < 0.0f)
+      instance.time += clip->GetDuration();
+  }
+
+  // whether the instance's LOD tier asks for a new pose this frame
+  bool IsDue(const AnimationInstance &instance) const {
+    int interval = instance.tier == AnimationLodStats::culled
+                       ? std::max(1, m_LodSettings.culledInterval)
+                       : 1 << instance.tier;
+    return m_Frame - instance.lastEvaluatedFrame >= interval;
+  }
+
+  int MinSampledHeight(const AnimationInstance &instance) const {
+    if (instance.tier >= AnimationLodSettings::tierCount - 1)
+      return m_LodSettings.leafSkipHeight;
+    return 0;
+  }
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef ASSET_LOADER_HPP
+#define ASSET_LOADER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+
+#include "thread_pool.hpp"
+
+/* loads assets in two halves. The read half (file IO, Assimp, image
+decoding) runs on a worker thread and returns the upload half, which
+creates the GL objects and is run on the GL thread by update() or finish().
+Independent loads overlap with each other and with whatever the GL thread
+does in the meantime */
+class AssetLoader {
+public:
+  using Upload = std::function<void()>;
+  using Read = std::function<Upload()>;
+
+  AssetLoader(unsigned int num_threads = std::thread::hardware_concurrency())
+      : pool(num_threads) {}
+
+  // queues read on a worker. It must not touch GL; it may return an empty
+  // Upload if there is nothing left for the GL thread to do
+  void load(Read read) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      reading++;
+    }
+    // with a single core the pool has no workers, so read right here
+    if (pool.size() == 1)
+      run(read);
+    else
+      pool.submit([this, read] { run(read); });
+  }
+
+  // runs the uploads that are ready without waiting for the rest. GL thread
+  // only. Returns the number run
+  int update() {
+    int uploaded = 0;
+    Upload upload;
+    while (take(upload, false)) {
+      if (upload)
+        upload();
+      uploaded++;
+    }
+    return uploaded;
+  }
+
+  // waits for every queued load, running uploads as they come in. GL thread
+  // only. Rethrows the first exception a read threw
+  void finish() {
+    Upload upload;
+    while (take(upload, true))
+      if (upload)
+        upload();
+    std::exception_ptr failed = error;
+    error = nullptr;
+    if (failed)
+      std::rethrow_exception(failed);
+  }
+
+  ~AssetLoader() {
+    // reads still running reference this loader. Uploads never taken are
+    // dropped
+    std::unique_lock<std::mutex> lock(mutex);
+    ready.wait(lock, [this] { return reading == 0; });
+  }
+
+  AssetLoader(const AssetLoader &) = delete;
+  AssetLoader &operator=(const AssetLoader &) = delete;
+
+private:
+  ThreadPool pool;
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<Upload> uploads;
+  int reading = 0; // reads queued or running
+  std::exception_ptr error;
+
+  void run(const Read &read) {
+    Upload upload;
+    std::exception_ptr failed;
+    try {
+      upload = read();
+    } catch (...) {
+      failed = std::current_exception();
+    }
+    // notified under the lock, the destructor may run as soon as it's released
+    std::lock_guard<std::mutex> lock(mutex);
+    if (failed && !error)
+      error = failed;
+    uploads.push_back(std::move(upload));
+    reading--;
+    ready.notify_all();
+  }
+
+  // pops the next upload, waiting for one if wait is set and reads are
+  // still running. False once there is nothing left to take
+  bool take(Upload &upload, bool wait) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (wait)
+      ready.wait(lock, [this] { return !uploads.empty() || reading == 0; });
+    if (uploads.empty())
+      return false;
+    upload = std::move(uploads.front());
+    uploads.pop_front();
+    return true;
+  }
+};
+
+#endif
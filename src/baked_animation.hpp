@@ -0,0 +1,155 @@
+#ifndef BAKED_ANIMATION_HPP
+#define BAKED_ANIMATION_HPP
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../include/glad/glad.h"
+
+#include <glm/glm.hpp>
+
+#include "animation.hpp"
+#include "gl_object.hpp"
+#include "shader.hpp"
+
+/* clips sampled at a fixed rate into one RGBA32F texture. Every row is the
+palette of one frame, with four texels (the matrix columns) per bone, and
+clips are stacked one after another down the texture */
+class BakedAnimations {
+public:
+  // must match MAX_CLIPS in character_baked_vertex.glsl
+  static constexpr int max_clips = 16;
+
+  BakedAnimations(float sample_rate = 30.0f)
+      : sample_rate(sample_rate), bones_per_row(0) {}
+
+  // samples clip over its whole duration and returns its clip id. Only
+  // before upload()
+  int add_clip(Animation &clip) {
+    if (texture) {
+      std::ostringstream error_message;
+      error_message << "Cannot bake clip " << clip.GetName()
+                    << " after the animation texture was uploaded.";
+      throw std::logic_error(error_message.str());
+    }
+    if (clips.size() == max_clips) {
+      std::ostringstream error_message;
+      error_message << "Cannot bake more than " << max_clips << " clips.";
+      throw std::logic_error(error_message.str());
+    }
+
+    float seconds = clip.GetDuration() / clip.GetTicksPerSecond();
+    int frame_count = std::max(1, (int)std::ceil(seconds * sample_rate));
+    int palette_size = clip.GetPaletteSize();
+
+    BakedClip baked;
+    baked.first_row = total_frames();
+    baked.frame_count = frame_count;
+    baked.palette_size = palette_size;
+    baked.palettes.resize(frame_count * palette_size, glm::mat4(1.0f));
+
+    std::vector<KeyCursor> cursors(clip.GetBoneCount());
+    std::vector<glm::mat4> globals(clip.GetNodes().size());
+    for (int frame = 0; frame < frame_count; frame++) {
+      float ticks = frame / sample_rate * clip.GetTicksPerSecond();
+      ticks = std::fmod(ticks, clip.GetDuration());
+      clip.Evaluate(ticks, cursors.data(), globals.data(),
+                    baked.palettes.data() + frame * palette_size);
+    }
+
+    bones_per_row = std::max(bones_per_row, palette_size);
+    clips.push_back(std::move(baked));
+    return clips.size() - 1;
+  }
+
+  /* creates the texture from every clip added and frees their sampled
+  palettes, so it is called once, after the last add_clip() */
+  void upload() {
+    if (texture)
+      throw std::logic_error("Baked animations were already uploaded.");
+
+    int width = bones_per_row * 4;
+    int height = total_frames();
+    std::vector<glm::vec4> texels(width * height, glm::vec4(0.0f));
+
+    for (const BakedClip &clip : clips) {
+      for (int frame = 0; frame < clip.frame_count; frame++) {
+        glm::vec4 *row = texels.data() + (clip.first_row + frame) * width;
+        const glm::mat4 *palette =
+            clip.palettes.data() + frame * clip.palette_size;
+        for (int bone = 0; bone < clip.palette_size; bone++)
+          for (int column = 0; column < 4; column++)
+            row[bone * 4 + column] = palette[bone][column];
+      }
+    }
+
+    int max_size;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    if (width > max_size || height > max_size) {
+      std::ostringstream error_message;
+      error_message << "Baked animation texture is " << width << "x" << height
+                    << ", larger than the maximum of " << max_size << ".";
+      throw std::logic_error(error_message.str());
+    }
+
+    texture = GLTexture::generate();
+    glBindTexture(GL_TEXTURE_2D, texture.id());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA,
+                 GL_FLOAT, texels.data());
+    // only ever read with texelFetch
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // the texture is the only copy needed from here on
+    for (BakedClip &clip : clips)
+      std::vector<glm::mat4>().swap(clip.palettes);
+  }
+
+  /* points shader's boneTexture at unit and sets the clip table. Uniforms
+  keep their values, so this is once per shader, after upload() */
+  void set_uniforms(Shader &shader, int unit) {
+    std::vector<glm::vec2> table;
+    for (const BakedClip &clip : clips)
+      table.push_back(glm::vec2(clip.first_row, clip.frame_count));
+    shader.setInt("boneTexture", unit);
+    shader.setFloat("sampleRate", sample_rate);
+    if (!table.empty())
+      shader.setVec2Array("clips", table.data(), table.size());
+  }
+
+  // binds the texture to unit, for a shader set up with set_uniforms
+  void bind(int unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, texture.id());
+  }
+
+  int clip_count() const { return clips.size(); }
+
+private:
+  struct BakedClip {
+    int first_row;
+    int frame_count;
+    int palette_size;
+    std::vector<glm::mat4> palettes; // dropped once uploaded
+  };
+
+  float sample_rate;
+  GLTexture texture;
+  int bones_per_row;
+  std::vector<BakedClip> clips;
+
+  int total_frames() const {
+    int frames = 0;
+    for (const BakedClip &clip : clips)
+      frames += clip.frame_count;
+    return frames;
+  }
+};
+
+#endif
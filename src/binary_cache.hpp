@@ -0,0 +1,181 @@
+#ifndef BINARY_CACHE_HPP
+#define BINARY_CACHE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* size and modification time of a source file. A cache built from the file
+records its stamp and is stale once the stamp changes */
+struct SourceStamp {
+  uint64_t size = 0;
+  int64_t modified = 0; // nanoseconds since the epoch
+
+  // zeroes if path can't be read
+  static SourceStamp of(const std::string &path) {
+    SourceStamp stamp;
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0) {
+      stamp.size = info.st_size;
+      stamp.modified =
+          int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    }
+    return stamp;
+  }
+
+  bool operator==(const SourceStamp &other) const {
+    return size == other.size && modified == other.modified;
+  }
+};
+
+/* a whole file mapped read-only into memory */
+class MappedFile {
+public:
+  MappedFile() : bytes(nullptr), length(0) {}
+
+  // false if path doesn't exist or can't be mapped
+  bool open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+      ::close(fd);
+      return false;
+    }
+    void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file alive on its own
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+      return false;
+    bytes = static_cast<const char *>(mapping);
+    length = info.st_size;
+    return true;
+  }
+
+  void close() {
+    if (bytes)
+      munmap(const_cast<char *>(bytes), length);
+    bytes = nullptr;
+    length = 0;
+  }
+
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data() const { return bytes; }
+  size_t size() const { return length; }
+
+private:
+  const char *bytes;
+  size_t length;
+};
+
+/* reads plain values and arrays out of a byte range without copying them.
+Reading past the end marks the reader as failed, and from then on it yields
+null pointers and default constructed values, so callers can check ok()
+once at the end */
+class BinaryReader {
+public:
+  BinaryReader(const char *data, size_t size)
+      : data(data), size(size), offset(0), failed(false) {}
+
+  template <typename T> T read() {
+    T value = T();
+    if (const char *source = take(sizeof(T)))
+      std::memcpy(static_cast<void *>(&value), source, sizeof(T));
+    return value;
+  }
+
+  std::string read_string() {
+    uint32_t length = read<uint32_t>();
+    const char *chars = take(length);
+    return chars ? std::string(chars, length) : std::string();
+  }
+
+  // pointer to count values inside the range, without a copy. Arrays start
+  // 16 byte aligned, so the pointer can be handed straight to the GPU
+  template <typename T> const T *read_array(size_t count) {
+    align();
+    if (count > (size - offset) / sizeof(T))
+      failed = true;
+    return reinterpret_cast<const T *>(take(sizeof(T) * count));
+  }
+
+  bool ok() const { return !failed; }
+
+  // for callers that find the data itself invalid
+  void fail() { failed = true; }
+
+private:
+  const char *data;
+  size_t size;
+  size_t offset;
+  bool failed;
+
+  const char *take(size_t bytes) {
+    if (failed || bytes > size - offset) {
+      failed = true;
+      return nullptr;
+    }
+    const char *start = data + offset;
+    offset += bytes;
+    return start;
+  }
+
+  void align() {
+    size_t aligned = (offset + 15) & ~size_t(15);
+    if (aligned > size)
+      failed = true;
+    else
+      offset = aligned;
+  }
+};
+
+/* the writing side of BinaryReader */
+class BinaryWriter {
+public:
+  BinaryWriter(const std::string &path)
+      : stream(path, std::ios::binary | std::ios::trunc), offset(0) {}
+
+  template <typename T> void write(const T &value) {
+    put(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+
+  void write_string(const std::string &value) {
+    write<uint32_t>(value.size());
+    put(value.data(), value.size());
+  }
+
+  template <typename T> void write_array(const T *values, size_t count) {
+    align();
+    put(reinterpret_cast<const char *>(values), sizeof(T) * count);
+  }
+
+  bool ok() const { return stream.good(); }
+
+private:
+  std::ofstream stream;
+  size_t offset;
+
+  void put(const char *bytes, size_t count) {
+    stream.write(bytes, count);
+    offset += count;
+  }
+
+  void align() {
+    static const char padding[16] = {};
+    put(padding, ((offset + 15) & ~size_t(15)) - offset);
+  }
+};
+
+#endif
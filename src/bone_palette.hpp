@@ -0,0 +1,60 @@
+#ifndef BONE_PALETTE_HPP
+#define BONE_PALETTE_HPP
+
+#include "../include/glad/glad.h"
+
+#include <glm/glm.hpp>
+
+#include "gl_object.hpp"
+#include "shader.hpp"
+
+/* final bone matrices in a texture buffer. The whole palette goes up in one
+call per frame and the skinning shaders read it with texelFetch, four RGBA32F
+texels per matrix, so its size is whatever the caller uploads rather than a
+fixed uniform array */
+class BonePalette {
+public:
+  BonePalette() : capacity(0) {}
+
+  void upload(const glm::mat4 *matrices, int count) {
+    if (!buffer) {
+      buffer = GLBuffer::generate();
+      texture = GLTexture::generate();
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer.id());
+    if (count > capacity) {
+      capacity = count;
+      glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::mat4) * capacity, matrices,
+                   GL_STREAM_DRAW);
+      glBindTexture(GL_TEXTURE_BUFFER, texture.id());
+      glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer.id());
+      glBindTexture(GL_TEXTURE_BUFFER, 0);
+    } else {
+      // orphan last frame's storage so the driver doesn't stall on it
+      glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::mat4) * capacity, NULL,
+                   GL_STREAM_DRAW);
+      glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(glm::mat4) * count,
+                      matrices);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  }
+
+  /* binds the palette to unit for a draw using the size matrices from
+  offset on. Bone ids past size fall back to the bind pose in the shaders
+  rather than reading another instance's matrices */
+  void bind(Shader &shader, int unit, int offset, int size) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_BUFFER, texture.id());
+    shader.setInt("finalBonesMatrices", unit);
+    shader.setInt("paletteOffset", offset);
+    shader.setInt("paletteSize", size);
+  }
+
+private:
+  GLBuffer buffer;
+  GLTexture texture;
+  int capacity;
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef BOUNDS_HPP
+#define BOUNDS_HPP
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+/* axis aligned bounding box. A default constructed box is empty and grows
+with every point or box added to it */
+struct AABB {
+  glm::vec3 min = glm::vec3(FLT_MAX);
+  glm::vec3 max = glm::vec3(-FLT_MAX);
+
+  bool empty() const { return min.x > max.x; }
+
+  void expand(const glm::vec3 &point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+
+  void expand(const AABB &box) {
+    if (box.empty())
+      return;
+    min = glm::min(min, box.min);
+    max = glm::max(max, box.max);
+  }
+
+  glm::vec3 center() const { return (min + max) * 0.5f; }
+
+  // radius of the sphere around center() that encloses the box
+  float radius() const { return glm::length(max - min) * 0.5f; }
+
+  /* the box around this one after transform, which is conservative for any
+  affine transform. Each output axis takes the extreme of every column's
+  contribution rather than transforming all eight corners */
+  AABB transformed(const glm::mat4 &transform) const {
+    if (empty())
+      return AABB();
+    AABB box;
+    box.min = box.max = glm::vec3(transform[3]);
+    for (int column = 0; column < 3; column++) {
+      glm::vec3 axis(transform[column]);
+      glm::vec3 a = axis * min[column];
+      glm::vec3 b = axis * max[column];
+      box.min += glm::min(a, b);
+      box.max += glm::max(a, b);
+    }
+    return box;
+  }
+};
+
+/* sphere around a set of points. Empty, with a negative radius, until
+something is added */
+struct BoundingSphere {
+  glm::vec3 center = glm::vec3(0.0f);
+  float radius = -1.0f;
+
+  bool empty() const { return radius < 0.0f; }
+
+  // the smallest sphere around this one and sphere
+  void expand(const BoundingSphere &sphere) {
+    if (sphere.empty())
+      return;
+    if (empty()) {
+      *this = sphere;
+      return;
+    }
+    glm::vec3 offset = sphere.center - center;
+    float distance = glm::length(offset);
+    if (distance + sphere.radius <= radius)
+      return;
+    if (distance + radius <= sphere.radius) {
+      *this = sphere;
+      return;
+    }
+    float new_radius = (distance + radius + sphere.radius) * 0.5f;
+    center += offset * ((new_radius - radius) / distance);
+    radius = new_radius;
+  }
+
+  // the sphere after transform. The radius grows with the longest axis, so
+  // it stays conservative under non-uniform scale
+  BoundingSphere transformed(const glm::mat4 &transform) const {
+    if (empty())
+      return BoundingSphere();
+    float scale = std::max(glm::length(glm::vec3(transform[0])),
+                           std::max(glm::length(glm::vec3(transform[1])),
+                                    glm::length(glm::vec3(transform[2]))));
+    BoundingSphere sphere;
+    sphere.center = glm::vec3(transform * glm::vec4(center, 1.0f));
+    sphere.radius = radius * scale;
+    return sphere;
+  }
+};
+
+/* a box and a sphere around the same points. The box is tighter for long
+thin shapes, the sphere is cheaper to test and to transform */
+struct Bounds {
+  AABB box;
+  BoundingSphere sphere;
+
+  bool empty() const { return box.empty(); }
+
+  /* around count points stride bytes apart, each a glm::vec3 at the start of
+  its element. The sphere is centred on the box, with the radius of the
+  furthest point, which is tighter than the sphere around the box */
+  static Bounds of(const void *points, size_t count, size_t stride) {
+    const char *bytes = static_cast<const char *>(points);
+    Bounds bounds;
+    glm::vec3 point;
+    for (size_t i = 0; i < count; i++) {
+      std::memcpy(&point, bytes + stride * i, sizeof(point));
+      bounds.box.expand(point);
+    }
+    if (bounds.box.empty())
+      return bounds;
+    bounds.sphere.center = bounds.box.center();
+    float radius_squared = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+      std::memcpy(&point, bytes + stride * i, sizeof(point));
+      glm::vec3 offset = point - bounds.sphere.center;
+      radius_squared = std::max(radius_squared, glm::dot(offset, offset));
+    }
+    bounds.sphere.radius = std::sqrt(radius_squared);
+    return bounds;
+  }
+
+  void expand(const Bounds &bounds) {
+    box.expand(bounds.box);
+    sphere.expand(bounds.sphere);
+  }
+
+  Bounds transformed(const glm::mat4 &transform) const {
+    Bounds bounds;
+    bounds.box = box.transformed(transform);
+    bounds.sphere = sphere.transformed(transform);
+    return bounds;
+  }
+};
+
+#endif
@@ -1,28 +1,17 @@
 #ifndef BOX_HPP
 #define BOX_HPP
 
+#include <memory>
 #include <vector>
+#include "gl_object.hpp"
 #include "shader.hpp"
 #include "camera.hpp"
 
+/* a unit cube. Every Box draws the same vertex buffer, so boxes are cheap
+to copy */
 class Box {
 public:
-  Box(Shader shader) : shader(shader) {
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glBindVertexArray(0);
-
+  Box(Shader shader) : shader(shader), geometry(shared_geometry()) {
     scale_vec = glm::vec3(1, 1, 1);
     position_vec = glm::vec3(0, 0, 0);
     color_vec = glm::vec3(1, 1, 1);
@@ -65,7 +54,7 @@ public:
 
       shader.setMat4("model", model);
     }
-    glBindVertexArray(vao);
+    glBindVertexArray(geometry->vao.id());
     glDrawArrays(GL_TRIANGLES, 0, 36);
   }
 
@@ -74,15 +63,12 @@ public:
   glm::vec3 position_vec;
   glm::vec3 pos;
 private:
-  unsigned int vao;
-  unsigned int vbo;
-
-  glm::mat4 cameraProjection;
-
-  glm::vec3 scale_vec;
-  glm::vec3 color_vec;
+  struct Geometry {
+    GLVertexArray vao;
+    GLBuffer vbo;
 
-  std::vector<float> vertices = {
+    Geometry() : vao(GLVertexArray::generate()), vbo(GLBuffer::generate()) {
+      static const float vertices[] = {
         // positions          // normals           // texture coords
         -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f,  0.0f,
          0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f,  0.0f,
@@ -125,8 +111,39 @@ private:
          0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  1.0f,  0.0f,
         -0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  0.0f,
         -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  1.0f
+      };
+
+      glBindVertexArray(vao.id());
+      glBindBuffer(GL_ARRAY_BUFFER, vbo.id());
+      glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+
+      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+      glEnableVertexAttribArray(0);
+      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+      glEnableVertexAttribArray(1);
+      glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+      glEnableVertexAttribArray(2);
+      glBindVertexArray(0);
+    }
   };
 
+  // made by the first Box alive and deleted with the last
+  static std::shared_ptr<Geometry> shared_geometry() {
+    static std::weak_ptr<Geometry> current;
+    std::shared_ptr<Geometry> geometry = current.lock();
+    if (!geometry) {
+      geometry = std::make_shared<Geometry>();
+      current = geometry;
+    }
+    return geometry;
+  }
+
+  std::shared_ptr<Geometry> geometry;
+
+  glm::mat4 cameraProjection;
+
+  glm::vec3 scale_vec;
+  glm::vec3 color_vec;
 };
 
 #endif
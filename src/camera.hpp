@@ -4,6 +4,8 @@
 #include "glm/ext/matrix_clip_space.hpp"
 #include "glm/ext/matrix_transform.hpp"
 
+#include "frustum.hpp"
+
 
 class Camera {
 private:
@@ -62,6 +64,11 @@ public:
 
   glm::mat4 projection() const { return proj; }
 
+  Frustum frustum() { return Frustum(proj * view()); }
+
+  // vertical field of view in degrees
+  float fov() const { return fovy; }
+
   void forward() { position += glm::normalize(view_direction) * move_speed; clamp(); }
 
   void backward() { position -= glm::normalize(view_direction) * move_speed; clamp(); }
@@ -100,6 +107,12 @@ public:
   }
 
   glm::vec3 pos() { return position; }
+
+  // pixels on screen covered by something one unit tall, one unit in front
+  // of the camera
+  float pixel_scale() const {
+    return height / (2.0f * tan(glm::radians(fovy) * 0.5f));
+  }
 };
 
 #endif
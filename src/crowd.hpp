@@ -0,0 +1,83 @@
+#ifndef CROWD_HPP
+#define CROWD_HPP
+
+#include <vector>
+
+#include "../include/glad/glad.h"
+
+#include <glm/glm.hpp>
+
+#include "baked_animation.hpp"
+#include "camera.hpp"
+#include "gl_object.hpp"
+#include "model.hpp"
+#include "shader.hpp"
+
+// per-instance data for a crowd member, matches locations 5 and 6 in
+// character_baked_vertex.glsl
+struct CrowdInstance {
+  glm::vec4 placement; // xyz position, w yaw in radians
+  glm::vec2 animation; // x clip id, y time offset in seconds
+};
+
+/* many copies of a skinned Model drawn with one instanced call per mesh. Poses
+come from a BakedAnimations texture, so nothing is uploaded per character.
+animations must be uploaded before the crowd is created */
+class Crowd {
+public:
+  Crowd(Shader shader, Model &model, BakedAnimations &animations)
+      : shader(shader), model(model), animations(animations),
+        uploaded_count(0), scale(1.0f) {
+    animations.set_uniforms(this->shader, animation_unit);
+  }
+
+  void add(glm::vec3 position, float yaw, int clip, float time_offset) {
+    CrowdInstance instance;
+    instance.placement = glm::vec4(position, yaw);
+    instance.animation = glm::vec2(clip, time_offset);
+    instances.push_back(instance);
+  }
+
+  void set_scale(float scale) { this->scale = scale; }
+
+  // copies the instances to the GPU; call again after adding more
+  void upload() {
+    if (!vbo) {
+      vbo = GLBuffer::generate();
+      model.set_instance_buffer(vbo.id(), 5, {4, 2}, sizeof(CrowdInstance));
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, vbo.id());
+    glBufferData(GL_ARRAY_BUFFER, sizeof(CrowdInstance) * instances.size(),
+                 instances.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    uploaded_count = instances.size();
+  }
+
+  // time is in seconds; each instance adds its own offset
+  void draw(Camera &camera, float time) {
+    if (uploaded_count == 0)
+      return;
+    shader.bind();
+    shader.setFloat("time", time);
+    shader.setFloat("scale", scale);
+    shader.setVec3("cameraPosition", camera.pos());
+    animations.bind(animation_unit);
+    model.draw_instanced(shader, camera, uploaded_count);
+  }
+
+  int size() const { return instances.size(); }
+
+  Shader shader;
+private:
+  // texture units below this are taken by the model's own textures
+  static constexpr int animation_unit = 8;
+
+  Model &model;
+  BakedAnimations &animations;
+  GLBuffer vbo;
+  int uploaded_count;
+  float scale;
+  std::vector<CrowdInstance> instances;
+};
+
+#endif
@@ -1,3 +1,4 @@
+#include <chrono>
 #include <cmath>
 #include <glm/ext/vector_float3.hpp>
 #include <stdexcept>
@@ -20,8 +21,18 @@ int main(void) {
   float near = 0.1f;
   float far = 1000.0f;
   GLFWwindow *window = initialize_glfw(width, height);
+  // terminates GLFW as main returns, after the GL objects owned by the locals
+  // below have been deleted while their context still exists
+  struct GlfwSession {
+    ~GlfwSession() { glfwTerminate(); }
+  } glfw_session;
   initialize_glad();
   setup_window(window, width, height);
+  TextureCache::shared().set_compression(TextureCompression::supported());
+  // mipmapped textures load as their coarse levels and stream the rest in
+  // once the render loop runs
+  TextureStreamer texture_streamer;
+  TextureCache::shared().set_streamer(&texture_streamer);
 
   // glm::vec3 ground_color(0.1f, 0.9f, 0.35f);
   glm::vec3 ground_color(0.06f, 0.2f, 0.14f);
@@ -45,8 +56,13 @@ int main(void) {
                        "../shaders/depth_shader_fragment.glsl");
   depth_shader.setMat4("projection", light_projection);
   depth_shader.setMat4("view", light_view);
+  // file reading, Assimp and image decoding run on the loader's workers
+  // while this thread carries on with the GL setup below. Everything loaded
+  // through it is ready after loader.finish()
+  AssetLoader loader;
+  auto load_start = std::chrono::steady_clock::now();
   // ---------------------- Sky -----------------------
-  Sky night_sky("../assets/stars/");
+  Sky night_sky("../assets/stars/", loader);
   // ----------------------------------------------------
 
   // ---------------------- ground -----------------------
@@ -72,7 +88,7 @@ int main(void) {
     "../shaders/grass_fragment.glsl"
   );
   Grass grass(grass_shader, num_grass, ground_y);
-  grass.setTexture("../assets/grass_cut.png");
+  grass.setTexture("../assets/grass_cut.png", loader);
   set_directional_light(grass.shader);
   // ---------------------- tree -----------------------
   std::vector<glm::vec3> apple_positions = {
@@ -94,11 +110,14 @@ int main(void) {
     Box apple(apple_shader);
     apple.color(apple_color.r, apple_color.g, apple_color.b);
     apple.position(apple_positions[i].x, apple_positions[i].y, apple_positions[i].z);
-    apples.push_back(apple);
+    apples.push_back(std::move(apple));
   }
 
   size_t num_trees = 20;
   std::vector<std::pair<Model, Quad>> trees;
+  // imported once, every tree draws the same meshes and textures
+  std::shared_ptr<ModelAsset> tree_asset =
+      ModelCache::shared().load_async(loader, "../assets/tree/oak_tree.obj");
   for (size_t i = 0; i < num_trees; i++) {
     float x_range = num_trees * 100;
     float z_range = num_trees * 100;
@@ -112,7 +131,7 @@ int main(void) {
 
     Shader tree_shader("../shaders/tree_model_vertex.glsl",
                        "../shaders/tree_model_fragment.glsl");
-    Model tree_model(tree_shader, "../assets/tree/oak_tree.obj");
+    Model tree_model(tree_shader, tree_asset);
     tree_model.set_scale(.05, .09, .05);
     tree_model.set_angle(270, glm::vec3(1, 0, 0));
     tree_model.set_pos(x, ground_y, z);
@@ -147,7 +166,7 @@ int main(void) {
       set_point_light(tree_model.shader, apple_color, pos, j);
     }
 
-    trees.push_back(std::make_pair(tree_model, shadow_quad));
+    trees.emplace_back(std::move(tree_model), std::move(shadow_quad));
   }
   // ---------------------- character -------------------
   Shader character_shader(
@@ -156,23 +175,126 @@ int main(void) {
   );
 
   const std::string character_file_path =
-  "../assets/vampire/dancing_vampire.dae"; Model character(character_shader,
-  character_file_path); Animation character_animation(character_file_path,
-  &character); Animator character_animator(&character_animation);
+      "../assets/vampire/dancing_vampire.dae";
+  std::shared_ptr<ModelAsset> character_asset =
+      std::make_shared<ModelAsset>(character_file_path);
+  Model character(character_shader, character_asset);
+  std::unique_ptr<AnimationLibrary> character_clips;
+  ClipCompressionReport character_compression;
+  float character_load_ms = 0.0f;
+  // one import feeds both the mesh and every clip in the file. Clips aren't
+  // in the binary cache, so the character always goes through Assimp. The
+  // worker only touches character's asset, which nothing else reads until
+  // loader.finish()
+  auto character_load_start = std::chrono::steady_clock::now();
+  loader.load([&]() -> AssetLoader::Upload {
+    character_asset->read(false);
+    character_clips =
+        std::make_unique<AnimationLibrary>(character_asset->scene(), character);
+    character_compression =
+        character_clips->Get(0)->Compress(ClipCompressionSettings());
+    character_asset->decode_images();
+    return [&] {
+      character_asset->upload();
+      std::chrono::duration<float, std::milli> elapsed =
+          std::chrono::steady_clock::now() - character_load_start;
+      character_load_ms = elapsed.count();
+    };
+  });
+
+  loader.finish();
+  std::chrono::duration<float, std::milli> load_time =
+      std::chrono::steady_clock::now() - load_start;
+  for (const ModelLoadReport &report : ModelCache::shared().get_reports())
+    print_load_report(report);
+  print_load_report({character_file_path, false, character_load_ms});
+  std::cout << "Loaded all assets in " << load_time.count() << " ms\n";
+  print_vertex_report("../assets/tree/oak_tree.obj", *tree_asset);
+  print_vertex_report(character_file_path, *character_asset);
+  print_lod_report("../assets/tree/oak_tree.obj", *tree_asset);
+  for (const TextureBakeReport &report : TextureCache::shared().get_reports())
+    print_texture_report(report);
+  print_texture_cache_report(TextureCache::shared().get_stats());
+  for (const auto &asset : {tree_asset, character_asset})
+    for (const MeshOptimizationReport &report : asset->optimization_reports)
+      print_optimization_report(report);
+
+  Animation &character_animation = *character_clips->Get(0);
+  print_compression_report(character_file_path, character_compression);
+
+  AnimationSystem animations;
+  // characters on the same clip within a 60 Hz frame of each other share
+  // one evaluated pose
+  animations.SetPoseCache(1.0f / 60.0f);
+  int character_instance = animations.AddInstance(&character_animation);
   character.set_scale(2, 2, 2);
   character.set_pos(6, -1.5, 1);
+  // palettes start out as identity, so this is the bind pose
+  AABB character_bounds = character.world_skinned_bounds(
+      animations.GetBoneMatrices(character_instance),
+      animations.GetBoneCount(character_instance));
+  animations.SetBounds(character_instance, character_bounds.center(),
+                       character_bounds.radius());
 
   set_directional_light(character.shader);
+
+  Shader character_depth_shader("../shaders/character_depth_vertex.glsl",
+                                "../shaders/depth_shader_fragment.glsl");
+  character_depth_shader.setMat4("projection", light_projection);
+  character_depth_shader.setMat4("view", light_view);
+  character.shadow_shader = character_depth_shader;
+
+  CharacterSkinning skinning;
+  skinning.skinning_shader =
+      Shader("../shaders/character_skinning_vertex.glsl",
+             std::vector<std::string>{"skinnedPosition", "skinnedNormal"});
+  skinning.skinned_shader = Shader("../shaders/character_skinned_vertex.glsl",
+                                   "../shaders/character_fragment.glsl");
+  set_directional_light(skinning.skinned_shader);
+  skinning.skinned_depth_shader =
+      Shader("../shaders/depth_shader_vertex.glsl",
+             "../shaders/depth_shader_fragment.glsl");
+  skinning.skinned_depth_shader.setMat4("projection", light_projection);
+  skinning.skinned_depth_shader.setMat4("view", light_view);
+
+  // blend shapes, if the character has any, are summed once per frame for
+  // every pass to read
+  Shader morph_shader("../shaders/morph_accumulate_vertex.glsl",
+                      "../shaders/morph_accumulate_fragment.glsl");
+  bool character_has_morphs = character.morph_target_count() > 0;
+
+  // every animated instance's bone matrices, uploaded once per frame
+  BonePalette bone_palette;
+  // ---------------------- crowd -----------------------
+  BakedAnimations baked_animations;
+  int dance_clip = baked_animations.add_clip(character_animation);
+  baked_animations.upload();
+
+  Shader crowd_shader(
+    "../shaders/character_baked_vertex.glsl",
+    "../shaders/character_fragment.glsl"
+  );
+  set_directional_light(crowd_shader);
+  Crowd crowd(crowd_shader, character, baked_animations);
+  crowd.set_scale(2);
+
+  int crowd_rows = 8;
+  float crowd_spacing = 4.0f;
+  for (int i = 0; i < crowd_rows * crowd_rows; i++) {
+    float x = 6 + (i % crowd_rows - crowd_rows / 2) * crowd_spacing;
+    float z = -10 - (i / crowd_rows) * crowd_spacing;
+    float offset = (static_cast<float>(rand()) / RAND_MAX) * 10.0f;
+    crowd.add(glm::vec3(x, -1.5, z), 0.0f, dance_clip, offset);
+  }
+  crowd.upload();
   // ---------------------- shadow framebuffers --------
-  unsigned int depth_fbo;
-  glGenFramebuffers(1, &depth_fbo);
+  GLFramebuffer depth_fbo = GLFramebuffer::generate();
 
   const unsigned shadow_width = 1024;
   const unsigned shadow_height = 1024;
 
-  unsigned int depth_map;
-  glGenTextures(1, &depth_map);
-  glBindTexture(GL_TEXTURE_2D, depth_map);
+  GLTexture depth_map = GLTexture::generate();
+  glBindTexture(GL_TEXTURE_2D, depth_map.id());
   glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, shadow_width,
                shadow_height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -180,9 +302,9 @@ int main(void) {
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
-  glBindFramebuffer(GL_FRAMEBUFFER, depth_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, depth_fbo.id());
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
-                         depth_map, 0);
+                         depth_map.id(), 0);
   glDrawBuffer(GL_NONE);
   glReadBuffer(GL_NONE);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -191,6 +313,8 @@ int main(void) {
   setup_imgui(window);
   float deltaTime = 0;
   float lastFrame = 0;
+  FrameStats stats;
+  GpuTimer scene_timer;
 
   // ---------------------- RENDER LOOP -----------------------
   while (!glfwWindowShouldClose(window)) {
@@ -205,32 +329,65 @@ int main(void) {
     deltaTime = currentFrame - lastFrame;
     lastFrame = currentFrame;
 
-    character_animator.UpdateAnimation(deltaTime);
+    double animation_start = glfwGetTime();
+    animations.Update(deltaTime, camera);
+    stats.animation_ms = (glfwGetTime() - animation_start) * 1000.0;
+    stats.animation_lod = animations.GetLodStats();
+    stats.pose_cache = animations.GetPoseCacheStats();
+    bone_palette.upload(animations.GetPalette().data(),
+                        animations.GetPalette().size());
+    // bounds of the new pose cull this frame's draw and pick next frame's
+    // animation LOD
+    character_bounds = character.world_skinned_bounds(
+        animations.GetBoneMatrices(character_instance),
+        animations.GetBoneCount(character_instance));
+    animations.SetBounds(character_instance, character_bounds.center(),
+                         character_bounds.radius());
     // ---------------------- Scene -----------------------
+    int palette_offset = animations.GetPaletteOffset(character_instance);
+    int palette_size = animations.GetBoneCount(character_instance);
+    scene_timer.begin();
+    if (character_has_morphs)
+      character.update_morph_targets(morph_shader);
+    if (skinning.pre_skin) {
+      bone_palette.bind(skinning.skinning_shader, 8, palette_offset,
+                        palette_size);
+      character.skin(skinning.skinning_shader);
+    }
 
     // render to the depth map
     glViewport(0, 0, shadow_width, shadow_height);
-    glBindFramebuffer(GL_FRAMEBUFFER, depth_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, depth_fbo.id());
     glClear(GL_DEPTH_BUFFER_BIT);
-    render_shadows(camera, trees, ground, light_view);
+    render_shadows(camera, trees, ground, character, bone_palette,
+                   palette_offset, palette_size, skinning, light_view);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     // render (including shadow mapping)
     glViewport(0, 0, width, height);
     glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 
-    render_scene(camera, night_sky, ground, trees, grass, character, character_animator, depth_map, apples);
+    render_scene(camera, night_sky, ground, trees, grass, character, character_bounds, bone_palette, palette_offset, palette_size, skinning, depth_map.id(), apples);
+    scene_timer.end();
+    stats.scene_gpu_ms = scene_timer.milliseconds();
+    stats.tree_lods.assign(tree_asset->lod_errors.size(), 0);
+    for (auto &[tree, quad] : trees)
+      if (tree.get_lod_level() < (int)stats.tree_lods.size())
+        stats.tree_lods[tree.get_lod_level()]++;
+    crowd.draw(camera, glfwGetTime());
+    texture_streamer.update();
+    stats.texture_streaming = texture_streamer.get_stats();
 
     // ----------------------------------------------------
 
-    imgui_new_frame(window, width, height, camera, deltaTime);
+    imgui_new_frame(window, width, height, camera, deltaTime, stats, skinning);
     glfwGetWindowSize(window, &width, &height);
     glfwSetWindowAspectRatio(window, width, height);
     glfwSwapBuffers(window);
     glfwPollEvents();
   }
 
-  glfwTerminate();
+  TextureCache::shared().set_streamer(nullptr);
   return 0;
 }
 
@@ -254,15 +411,26 @@ void set_point_light(Shader& shader, glm::vec3& color, glm::vec3& pos, int i) {
   shader.setFloat(light + "quadratic", 0.01f);
 }
 
-void render_shadows(Camera &camera, std::vector<std::pair<Model, Quad>> &trees, Box& ground, glm::mat4& light_view) {
+void render_shadows(Camera &camera, std::vector<std::pair<Model, Quad>> &trees, Box& ground,
+                    Model &character, BonePalette &bone_palette, int palette_offset, int palette_size,
+                    CharacterSkinning &skinning, glm::mat4& light_view) {
   for (auto& [tree, quad]: trees) {
     tree.draw(camera, true);
   }
+
+  if (skinning.pre_skin) {
+    character.draw_skinned(skinning.skinned_depth_shader, camera, true);
+  } else {
+    bone_palette.bind(character.shadow_shader, 8, palette_offset, palette_size);
+    character.draw(camera, true);
+  }
 }
 
 void render_scene(Camera &camera, Sky &night_sky, Box &ground,
                   std::vector<std::pair<Model, Quad>> &trees, Grass &grass, Model &character,
-                  Animator &animator, unsigned int depth_map, std::vector<Box>& apples) {
+                  const AABB &character_bounds, BonePalette &bone_palette, int palette_offset, int palette_size,
+                  CharacterSkinning &skinning, unsigned int depth_map,
+                  std::vector<Box>& apples) {
   night_sky.draw(camera);
 
   glm::vec3 camera_pos = camera.pos();
@@ -292,13 +460,17 @@ void render_scene(Camera &camera, Sky &night_sky, Box &ground,
   }
 
 
-  std::vector<glm::mat4> &transforms = animator.GetFinalBoneMatrices();
-  for (int i = 0; i < transforms.size(); ++i) {
-    character.shader.setMat4("finalBonesMatrices[" + std::to_string(i) + "]",
-                             transforms[i]);
+  if (!camera.frustum().intersects_aabb(character_bounds))
+    return;
+
+  if (skinning.pre_skin) {
+    skinning.skinned_shader.setVec3("cameraPosition", camera.pos());
+    character.draw_skinned(skinning.skinned_shader, camera);
+  } else {
+    bone_palette.bind(character.shader, 8, palette_offset, palette_size);
+    character.shader.setVec3("cameraPosition", camera.pos());
+    character.draw(camera);
   }
-  character.shader.setVec3("cameraPosition", camera.pos());
-  character.draw(camera);
 }
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
@@ -364,7 +536,8 @@ void setup_imgui(GLFWwindow *window) {
 }
 
 void imgui_new_frame(GLFWwindow *window, int width, int height, Camera &camera,
-                     float deltaTime) {
+                     float deltaTime, const FrameStats &stats,
+                     CharacterSkinning &skinning) {
   ImGui_ImplOpenGL3_NewFrame();
   ImGui_ImplGlfw_NewFrame();
   ImGuiIO &io = ImGui::GetIO();
@@ -375,6 +548,32 @@ void imgui_new_frame(GLFWwindow *window, int width, int height, Camera &camera,
   glm::vec3 pos = camera.pos();
   ImGui::Text("Camera: %.3f x, %.3f y, %.3f z", pos.x, pos.y, pos.z);
   ImGui::Text("Delta Time: %.3f", deltaTime);
+  ImGui::Text("Scene (GPU): %.3f ms", stats.scene_gpu_ms);
+  ImGui::Checkbox("Pre-skin character (transform feedback)",
+                  &skinning.pre_skin);
+  ImGui::Text("Animation: %.3f ms", stats.animation_ms);
+  const AnimationLodStats &lod = stats.animation_lod;
+  for (int tier = 0; tier <= AnimationLodStats::culled; tier++) {
+    if (tier == AnimationLodStats::culled)
+      ImGui::Text("  culled: %d instances, %d bones evaluated, %d saved",
+                  lod.instances[tier], lod.bonesEvaluated[tier],
+                  lod.bonesSaved[tier]);
+    else
+      ImGui::Text("  tier %d: %d instances, %d bones evaluated, %d saved",
+                  tier, lod.instances[tier], lod.bonesEvaluated[tier],
+                  lod.bonesSaved[tier]);
+  }
+  ImGui::Text("Pose cache: %d hits, %d misses, %d poses held",
+              stats.pose_cache.hits, stats.pose_cache.misses,
+              stats.pose_cache.entries);
+  for (size_t level = 0; level < stats.tree_lods.size(); level++)
+    ImGui::Text("Trees at LOD %zu: %d", level, stats.tree_lods[level]);
+  const TextureStreamingStats &streaming = stats.texture_streaming;
+  ImGui::Text("Texture streaming: %d textures, %.1f MB resident, %.1f MB "
+              "pending, %.1f KB uploaded, %d evictions",
+              streaming.textures, streaming.resident_bytes / 1048576.0f,
+              streaming.pending_bytes / 1048576.0f,
+              streaming.uploaded_bytes / 1024.0f, streaming.evictions);
   ImGui::End();
 
   ImGui::Render();
@@ -410,6 +609,78 @@ void render_quad() {
   glBindVertexArray(0);
 }
 
+void print_compression_report(const std::string &name,
+                              const ClipCompressionReport &report) {
+  std::cout << "Compressed " << name << ": " << report.bytesBefore
+            << " -> " << report.bytesAfter << " bytes, " << report.keysBefore
+            << " -> " << report.keysAfter << " keys, max joint error "
+            << report.maxJointError << ", max rotation error "
+            << glm::degrees(report.maxRotationError) << " degrees\n";
+}
+
+void print_load_report(const ModelLoadReport &report) {
+  std::cout << "Loaded " << report.path << " in " << report.milliseconds
+            << " ms ("
+            << (report.from_cache ? "warm, binary cache" : "cold, Assimp import")
+            << ")\n";
+}
+
+void print_vertex_report(const std::string &name, const ModelAsset &asset) {
+  size_t vertices = asset.vertex_count();
+  size_t indices = asset.index_count();
+  if (vertices == 0)
+    return;
+  // what the same meshes took as unpacked Vertex with 32 bit indices
+  size_t unpacked = vertices * sizeof(Vertex) + indices * sizeof(unsigned int);
+  size_t packed = asset.vertex_bytes() + asset.index_bytes();
+  std::cout << "Packed " << name << ": " << vertices << " vertices at "
+            << (float)asset.vertex_bytes() / vertices << " bytes (was "
+            << sizeof(Vertex) << "), " << indices << " indices at "
+            << (float)asset.index_bytes() / std::max<size_t>(indices, 1)
+            << " bytes (was 4). Buffers " << unpacked << " -> " << packed
+            << " bytes, " << 100.0f * (unpacked - packed) / unpacked
+            << "% less memory and vertex fetch per draw\n";
+}
+
+void print_optimization_report(const MeshOptimizationReport &report) {
+  std::cout << "Optimized mesh " << report.name << " (" << report.triangles
+            << " triangles): ACMR " << report.cache_before.acmr << " -> "
+            << report.cache_after.acmr << ", ATVR " << report.cache_before.atvr
+            << " -> " << report.cache_after.atvr << ", overdraw "
+            << report.overdraw_before << " -> " << report.overdraw_after
+            << "\n";
+}
+
+void print_lod_report(const std::string &name, const ModelAsset &asset) {
+  for (size_t level = 0; level < asset.lod_errors.size(); level++) {
+    size_t triangles = 0;
+    for (const Mesh &mesh : asset.meshes) {
+      int last = mesh.lod_count() - 1;
+      triangles += mesh.get_lod(std::min<int>(level, last)).index_count / 3;
+    }
+    std::cout << "LOD " << level << " of " << name << ": " << triangles
+              << " triangles, error " << asset.lod_errors[level] << "\n";
+  }
+}
+
+void print_texture_report(const TextureBakeReport &report) {
+  std::cout << "Loaded texture " << report.path << " in "
+            << report.milliseconds << " ms ("
+            << (report.from_cache
+                    ? "baked file, decoding took "
+                    : "cold, baked after decoding in ")
+            << report.decode_milliseconds << " ms), "
+            << texture_format_name(report.internal_format) << ", "
+            << report.bytes_before << " -> " << report.bytes_after
+            << " bytes\n";
+}
+
+void print_texture_cache_report(const TextureCacheStats &stats) {
+  std::cout << "Texture cache: " << stats.uploads << " textures from "
+            << stats.decodes << " decoded images, " << stats.hits
+            << " loads shared an existing texture\n";
+}
+
 void print_mat4(const glm::mat4& m) {
   for (int i = 0; i < 4; i++) {
     for (int j = 0; j < 4; j++) {
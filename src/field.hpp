@@ -12,18 +12,50 @@
 #include "box.hpp"
 #include "sky.hpp"
 #include "animation.hpp"
+#include "animation_system.hpp"
+#include "baked_animation.hpp"
+#include "bone_palette.hpp"
+#include "crowd.hpp"
+#include "gpu_timer.hpp"
 #include "quad.hpp"
 
+// timings and counters shown in the debug window
+struct FrameStats {
+  float animation_ms = 0.0f;
+  float scene_gpu_ms = 0.0f; // shadow and main pass, from a timer query
+  AnimationLodStats animation_lod;
+  PoseCacheStats pose_cache;
+  std::vector<int> tree_lods; // trees drawn at each level of detail
+  TextureStreamingStats texture_streaming;
+};
+
+// how the animated character is skinned. With pre_skin set, a transform
+// feedback pass skins its vertices once per frame and both the shadow and the
+// main pass draw the result as a static mesh
+struct CharacterSkinning {
+  bool pre_skin = false; // toggled from the debug window
+  Shader skinning_shader;
+  Shader skinned_shader;
+  Shader skinned_depth_shader;
+};
+
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void process_input(GLFWwindow* window);
 GLFWwindow* initialize_glfw(int width, int height);
 void initialize_glad();
 void setup_window(GLFWwindow* window, int width, int height);
 void setup_imgui(GLFWwindow* window);
-void imgui_new_frame(GLFWwindow* window, int width, int height, Camera& camera, float deltaTime);
+void imgui_new_frame(GLFWwindow* window, int width, int height, Camera& camera, float deltaTime, const FrameStats& stats, CharacterSkinning& skinning);
 void print_mat4(const glm::mat4& m);
-void render_scene(Camera& camera, Sky& night_sky, Box& ground, std::vector<std::pair<Model, Quad>>& trees, Grass& grass, Model& character, Animator& animator, unsigned int depth_map, std::vector<Box>& apples);
-void render_shadows(Camera &camera, std::vector<std::pair<Model, Quad>> &trees, Box& ground, glm::mat4& light_view);
+void print_compression_report(const std::string& name, const ClipCompressionReport& report);
+void print_load_report(const ModelLoadReport& report);
+void print_vertex_report(const std::string& name, const ModelAsset& asset);
+void print_optimization_report(const MeshOptimizationReport& report);
+void print_lod_report(const std::string& name, const ModelAsset& asset);
+void print_texture_report(const TextureBakeReport& report);
+void print_texture_cache_report(const TextureCacheStats& stats);
+void render_scene(Camera& camera, Sky& night_sky, Box& ground, std::vector<std::pair<Model, Quad>>& trees, Grass& grass, Model& character, const AABB& character_bounds, BonePalette& bone_palette, int palette_offset, int palette_size, CharacterSkinning& skinning, unsigned int depth_map, std::vector<Box>& apples);
+void render_shadows(Camera &camera, std::vector<std::pair<Model, Quad>> &trees, Box& ground, Model& character, BonePalette& bone_palette, int palette_offset, int palette_size, CharacterSkinning& skinning, glm::mat4& light_view);
 void set_directional_light(Shader& shader);
 void render_quad();
 void set_point_light(Shader& shader, glm::vec3& color, glm::vec3& pos, int i);
@@ -0,0 +1,58 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include <glm/glm.hpp>
+
+#include "bounds.hpp"
+
+/* the six planes of a view frustum, pointing inwards, pulled out of a
+projection * view matrix */
+class Frustum {
+public:
+  Frustum(const glm::mat4 &view_projection) {
+    glm::vec4 row0(view_projection[0][0], view_projection[1][0],
+                   view_projection[2][0], view_projection[3][0]);
+    glm::vec4 row1(view_projection[0][1], view_projection[1][1],
+                   view_projection[2][1], view_projection[3][1]);
+    glm::vec4 row2(view_projection[0][2], view_projection[1][2],
+                   view_projection[2][2], view_projection[3][2]);
+    glm::vec4 row3(view_projection[0][3], view_projection[1][3],
+                   view_projection[2][3], view_projection[3][3]);
+
+    planes[0] = row3 + row0; // left
+    planes[1] = row3 - row0; // right
+    planes[2] = row3 + row1; // bottom
+    planes[3] = row3 - row1; // top
+    planes[4] = row3 + row2; // near
+    planes[5] = row3 - row2; // far
+
+    for (int i = 0; i < 6; i++)
+      planes[i] = planes[i] * (1.0f / glm::length(glm::vec3(planes[i])));
+  }
+
+  bool intersects_sphere(const glm::vec3 &center, float radius) const {
+    for (int i = 0; i < 6; i++)
+      if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+        return false;
+    return true;
+  }
+
+  // false only when the box lies entirely behind one of the planes
+  bool intersects_aabb(const AABB &box) const {
+    for (int i = 0; i < 6; i++) {
+      glm::vec3 normal(planes[i]);
+      // the corner furthest along the plane normal
+      glm::vec3 corner(normal.x >= 0 ? box.max.x : box.min.x,
+                       normal.y >= 0 ? box.max.y : box.min.y,
+                       normal.z >= 0 ? box.max.z : box.min.z);
+      if (glm::dot(normal, corner) + planes[i].w < 0)
+        return false;
+    }
+    return true;
+  }
+
+private:
+  glm::vec4 planes[6];
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef GL_OBJECT_HPP
+#define GL_OBJECT_HPP
+
+#include "../include/glad/glad.h"
+
+/* owns one GL object name and deletes it with the owner. Move-only, so every
+object has exactly one owner; things that are copied around by value (Shader,
+Box, Quad) share theirs through a shared_ptr instead. Name 0 means empty,
+which is also what a moved-from object holds.
+
+Kind supplies the generate and destroy calls for one type of object, see the
+aliases below */
+template <typename Kind> class GLObject {
+public:
+  GLObject() : name(0) {}
+
+  // takes ownership of a name made elsewhere
+  explicit GLObject(GLuint name) : name(name) {}
+
+  static GLObject generate() { return GLObject(Kind::generate()); }
+
+  ~GLObject() { reset(); }
+
+  GLObject(GLObject &&other) noexcept : name(other.name) { other.name = 0; }
+
+  GLObject &operator=(GLObject &&other) noexcept {
+    if (this != &other) {
+      reset();
+      name = other.name;
+      other.name = 0;
+    }
+    return *this;
+  }
+
+  GLObject(const GLObject &) = delete;
+  GLObject &operator=(const GLObject &) = delete;
+
+  GLuint id() const { return name; }
+
+  explicit operator bool() const { return name != 0; }
+
+  // deletes the object, leaving this empty
+  void reset() {
+    if (name != 0)
+      Kind::destroy(name);
+    name = 0;
+  }
+
+private:
+  GLuint name;
+};
+
+struct GLBufferKind {
+  static GLuint generate() {
+    GLuint name;
+    glGenBuffers(1, &name);
+    return name;
+  }
+  static void destroy(GLuint name) { glDeleteBuffers(1, &name); }
+};
+
+struct GLVertexArrayKind {
+  static GLuint generate() {
+    GLuint name;
+    glGenVertexArrays(1, &name);
+    return name;
+  }
+  static void destroy(GLuint name) { glDeleteVertexArrays(1, &name); }
+};
+
+struct GLTextureKind {
+  static GLuint generate() {
+    GLuint name;
+    glGenTextures(1, &name);
+    return name;
+  }
+  static void destroy(GLuint name) { glDeleteTextures(1, &name); }
+};
+
+struct GLFramebufferKind {
+  static GLuint generate() {
+    GLuint name;
+    glGenFramebuffers(1, &name);
+    return name;
+  }
+  static void destroy(GLuint name) { glDeleteFramebuffers(1, &name); }
+};
+
+struct GLQueryKind {
+  static GLuint generate() {
+    GLuint name;
+    glGenQueries(1, &name);
+    return name;
+  }
+  static void destroy(GLuint name) { glDeleteQueries(1, &name); }
+};
+
+struct GLProgramKind {
+  static GLuint generate() { return glCreateProgram(); }
+  static void destroy(GLuint name) { glDeleteProgram(name); }
+};
+
+struct GLShaderKind {
+  static void destroy(GLuint name) { glDeleteShader(name); }
+};
+
+using GLBuffer = GLObject<GLBufferKind>;
+using GLVertexArray = GLObject<GLVertexArrayKind>;
+using GLTexture = GLObject<GLTextureKind>;
+using GLFramebuffer = GLObject<GLFramebufferKind>;
+using GLQuery = GLObject<GLQueryKind>;
+using GLProgram = GLObject<GLProgramKind>;
+// created by glCreateShader with a type, so adopted rather than generated
+using GLShader = GLObject<GLShaderKind>;
+
+#endif
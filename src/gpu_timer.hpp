@@ -0,0 +1,64 @@
+#ifndef GPU_TIMER_HPP
+#define GPU_TIMER_HPP
+
+#include "../include/glad/glad.h"
+
+#include "gl_object.hpp"
+
+/* GPU time spent between begin() and end(), measured with GL_TIME_ELAPSED
+queries. The queries go round a ring of query_count objects, and a result is
+only read once GL_QUERY_RESULT_AVAILABLE says it is there, so the timer never
+waits for the GPU. Until a newer result arrives milliseconds() keeps the
+last one. If the GPU falls so far behind that the next query is still
+pending, that frame goes unmeasured */
+class GpuTimer {
+public:
+  static constexpr int query_count = 4;
+
+  GpuTimer() : next(0), oldest(0), pending(0), active(false), last_ms(0.0f) {}
+
+  void begin() {
+    if (!queries[0])
+      for (GLQuery &query : queries)
+        query = GLQuery::generate();
+    active = pending < query_count;
+    if (active)
+      glBeginQuery(GL_TIME_ELAPSED, queries[next].id());
+  }
+
+  void end() {
+    if (active) {
+      glEndQuery(GL_TIME_ELAPSED);
+      next = (next + 1) % query_count;
+      pending++;
+      active = false;
+    }
+    // results arrive in the order the queries ended
+    while (pending > 0) {
+      GLint available = 0;
+      glGetQueryObjectiv(queries[oldest].id(), GL_QUERY_RESULT_AVAILABLE,
+                         &available);
+      if (!available)
+        break;
+      GLuint64 nanoseconds;
+      glGetQueryObjectui64v(queries[oldest].id(), GL_QUERY_RESULT,
+                            &nanoseconds);
+      last_ms = nanoseconds / 1.0e6f;
+      oldest = (oldest + 1) % query_count;
+      pending--;
+    }
+  }
+
+  // milliseconds for the latest begin()/end() pair the GPU has finished
+  float milliseconds() const { return last_ms; }
+
+private:
+  GLQuery queries[query_count];
+  int next;    // the query the next begin() uses
+  int oldest;  // the longest pending query
+  int pending; // queries ended but not read yet
+  bool active;
+  float last_ms;
+};
+
+#endif
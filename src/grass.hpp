@@ -2,20 +2,36 @@
 #define GRASS_HPP
 
 #include <vector>
+#include "asset_loader.hpp"
 #include "field.hpp"
+#include "gl_object.hpp"
 #include "shader.hpp"
 #include "camera.hpp"
 #include "helpers.hpp"
+#include "texture_cache.hpp"
 
+/* num instanced grass blades. The blade placements only exist on the CPU
+while the constructor fills the instance buffer */
 class Grass {
 public:
   Grass(Shader shader, size_t num, float ground_y) : num_instances(num), shader(shader) {
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    static const float vertices[] = {
+          // positions          // normals           // texture coords
+          -0.5f, -0.5f, 0.0f,  1.0f,  0.0f, -1.0f,  0.0f,  0.0f,
+           0.5f, -0.5f, 0.0f,  1.0f,  0.0f, -1.0f,  1.0f,  0.0f,
+           0.5f,  0.5f, 0.0f,  1.0f,  0.0f, -1.0f,  1.0f,  1.0f,
 
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+           0.5f,  0.5f, 0.0f,  1.0f,  0.0f, -1.0f,  1.0f,  1.0f,
+          -0.5f,  0.5f, 0.0f,  1.0f,  0.0f, -1.0f,  0.0f,  1.0f,
+          -0.5f, -0.5f, 0.0f,  1.0f,  0.0f, -1.0f,  0.0f,  0.0f,
+    };
+
+    vao = GLVertexArray::generate();
+    glBindVertexArray(vao.id());
+
+    vbo = GLBuffer::generate();
+    glBindBuffer(GL_ARRAY_BUFFER, vbo.id());
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
@@ -31,6 +47,8 @@ public:
     float z_range = sqrt((double)num_instances) * 10;
     glm::vec3 grass_axis(0, 1, 0);
   
+    std::vector<glm::mat4> models;
+    models.reserve(num_instances);
     for (size_t i = 0; i < num_instances; i++) {
       glm::mat4 model(1.0f);
       float angle = (static_cast<float>(rand()) / RAND_MAX) * 90.0f;
@@ -42,8 +60,8 @@ public:
       models.push_back(model);
     }
 
-    glGenBuffers(1, &model_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, model_vbo);
+    model_vbo = GLBuffer::generate();
+    glBindBuffer(GL_ARRAY_BUFFER, model_vbo.id());
     glBufferData(GL_ARRAY_BUFFER, num_instances * sizeof(glm::mat4), models.data(), GL_STATIC_DRAW);
 
     glEnableVertexAttribArray(3);
@@ -65,25 +83,15 @@ public:
   }
 
   void setTexture(std::string path) {
-    glBindVertexArray(vao);
-    int width, height, channels;
-    unsigned char* image = load_image(path, &width, &height, &channels, true);
-
-    glGenTextures(1, &texture_id);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // how to resample down
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // how to resample up
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    texture = TextureCache::shared().load(path, texture_params());
+    shader.setInt("inputTexture", 0);
+  }
 
-    stbi_image_free(image);
+  // decodes on one of loader's workers, unless the texture is cached already;
+  // it is filled in by the upload loader runs on this thread
+  void setTexture(std::string path, AssetLoader& loader) {
+    texture = TextureCache::shared().load_async(loader, path, texture_params());
     shader.setInt("inputTexture", 0);
-    glBindVertexArray(0);
   }
 
   void position(float r, float g, float b) {
@@ -110,7 +118,7 @@ public:
 
   void draw(Camera& camera) {
     shader.bind();
-    glBindVertexArray(vao);
+    glBindVertexArray(vao.id());
 
     if (camera.projection() != cameraProjection) {
       cameraProjection = camera.projection();
@@ -119,18 +127,19 @@ public:
     shader.setMat4("view", camera.view());
 
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
+    glBindTexture(GL_TEXTURE_2D, texture ? texture->id() : 0);
+    TextureCache::shared().touch(texture);
 
     glDrawArraysInstanced(GL_TRIANGLES, 0, 6, num_instances);
   }
 
   Shader shader;
 private:
-  unsigned int vao;
-  unsigned int vbo;
-  unsigned int model_vbo;
+  GLVertexArray vao;
+  GLBuffer vbo;
+  GLBuffer model_vbo;
   
-  unsigned int texture_id;
+  TextureCache::Handle texture;
   unsigned int num_instances;
 
   glm::mat4 cameraProjection;
@@ -142,19 +151,15 @@ private:
   glm::vec3 rotation_axis;
   float radians;
 
-  std::vector<glm::mat4> models;
-
-  std::vector<float> vertices = {
-        // positions          // normals           // texture coords
-        -0.5f, -0.5f, 0.0f,  1.0f,  0.0f, -1.0f,  0.0f,  0.0f,
-         0.5f, -0.5f, 0.0f,  1.0f,  0.0f, -1.0f,  1.0f,  0.0f,
-         0.5f,  0.5f, 0.0f,  1.0f,  0.0f, -1.0f,  1.0f,  1.0f,
-
-         0.5f,  0.5f, 0.0f,  1.0f,  0.0f, -1.0f,  1.0f,  1.0f,
-        -0.5f,  0.5f, 0.0f,  1.0f,  0.0f, -1.0f,  0.0f,  1.0f,
-        -0.5f, -0.5f, 0.0f,  1.0f,  0.0f, -1.0f,  0.0f,  0.0f,
-  };
-
+  // the same as Quad's, so a picture used by both is loaded once
+  static TextureParams texture_params() {
+    TextureParams params;
+    params.wrap = GL_CLAMP_TO_EDGE;
+    params.min_filter = GL_LINEAR; // how to resample down
+    params.mag_filter = GL_LINEAR; // how to resample up
+    params.flip = true;
+    return params;
+  }
 };
 
 #endif
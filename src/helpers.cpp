@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <string>
 #include <sstream>
 
@@ -6,6 +7,7 @@
 #include "../include/glad/glad.h"
 #include <GLFW/glfw3.h>
 
+#include "helpers.hpp"
 
 void check_gl_error(const char* file, int line) {
   GLenum err;
@@ -27,7 +29,8 @@ void check_gl_error(const char* file, int line) {
 }
 
 unsigned char* load_image(const std::string& file_path, int* width, int* height, int* channels, bool flip) {
-  stbi_set_flip_vertically_on_load(flip);
+  // stbi_set_flip_vertically_on_load is process wide, so rows are flipped
+  // here instead to keep decoding on worker threads independent
   unsigned char* image = stbi_load(file_path.c_str(), width, height, channels, 0);
   if (!image) {
     std::ostringstream error_message;
@@ -35,6 +38,19 @@ unsigned char* load_image(const std::string& file_path, int* width, int* height,
                   << file_path;
     throw std::logic_error(error_message.str());
   }
+  if (flip) {
+    size_t row = (size_t)*width * *channels;
+    for (int y = 0; y < *height / 2; y++)
+      std::swap_ranges(image + y * row, image + (y + 1) * row,
+                       image + (*height - 1 - y) * row);
+  }
+  return image;
+}
+
+Image read_image(const std::string& file_path, bool flip) {
+  Image image;
+  unsigned char* pixels = load_image(file_path, &image.width, &image.height, &image.channels, flip);
+  image.pixels = std::shared_ptr<unsigned char>(pixels, stbi_image_free);
   return image;
 }
 
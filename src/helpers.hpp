@@ -1,6 +1,7 @@
 #ifndef HELPERS_HPP
 #define HELPERS_HPP
 
+#include <memory>
 #include <string>
 #include <stb/stb_image.h>
 #include "../include/glad/glad.h"
@@ -13,6 +14,16 @@ void check_gl_error(const char* file, int line);
 #define GL_CHECK_ERROR()
 #endif
 
+// decoded 8 bit pixels, freed along with the last copy
+struct Image {
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  std::shared_ptr<unsigned char> pixels;
+};
+
+// both leave stb's global flip setting alone, so they can run on any thread
 unsigned char* load_image(const std::string& file_path, int* width, int* height, int* channels, bool flip);
+Image read_image(const std::string& file_path, bool flip);
 
 #endif
@@ -3,23 +3,17 @@
 
 #include "../include/glad/glad.h"
 
+#include <memory>
 #include <vector>
 
 #include <glm/glm.hpp>
 
+#include "bounds.hpp"
+#include "gl_object.hpp"
+#include "mesh_simplifier.hpp"
+#include "morph_targets.hpp"
 #include "shader.hpp"
-
-#define MAX_BONE_WEIGHTS 4
-
-struct Vertex {
-  glm::vec3 position;
-  glm::vec3 normal;
-  glm::vec2 textureCoords;
-
-  // animation related.
-  int boneIds[MAX_BONE_WEIGHTS];
-  float weights[MAX_BONE_WEIGHTS];
-};
+#include "vertex_format.hpp"
 
 struct Texture {
   unsigned int id;
@@ -27,28 +21,216 @@ struct Texture {
   std::string path;
 };
 
+/* vertex and index buffers of one mesh on the GPU. Move-only: the buffers
+are deleted with the Mesh, and the geometry isn't kept on the CPU once it is
+uploaded */
 class Mesh {
 public:
   Mesh(const std::vector<Vertex>& vertices,
        const std::vector<unsigned int>& indices,
        const std::vector<Texture> textures) :
-    vertices(vertices),
-    indices(indices),
-    textures(textures) {
+    Mesh(vertices.data(), vertices.size(), indices.data(), indices.size(),
+         textures) {}
 
-    // TODO: addTexture instead.
+  // packs into the smallest layout and index type that fit
+  Mesh(const Vertex* vertices, size_t vertex_count,
+       const unsigned int* indices, size_t index_count,
+       const std::vector<Texture> textures) :
+    Mesh(choose_vertex_layout(max_bone_id(vertices, vertex_count)),
+         pack_vertices(vertices, vertex_count,
+                       choose_vertex_layout(max_bone_id(vertices, vertex_count)))
+             .data(),
+         vertex_count,
+         choose_index_type(vertex_count),
+         pack_indices(indices, index_count, choose_index_type(vertex_count))
+             .data(),
+         index_count, textures) {
+    bounds = Bounds::of(vertices, vertex_count, sizeof(Vertex));
+  }
 
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ebo);
+  // uploads straight from vertices already packed in layout and indices of
+  // index_type (GL_UNSIGNED_SHORT or GL_UNSIGNED_INT). They only need to
+  // live until the constructor returns (a memory mapped cache file, for
+  // one). No CPU copy is kept, and bounds are left empty for set_bounds.
+  // lods are the ranges of indices that draw each
+  // level of detail, the full mesh first; without them every index is
+  // level 0
+  Mesh(VertexLayout layout, const void* vertices, size_t vertex_count,
+       GLenum index_type, const void* indices, size_t index_count,
+       const std::vector<Texture> textures,
+       const std::vector<MeshLod>& lods = std::vector<MeshLod>()) :
+    layout(layout),
+    index_type(index_type),
+    vertex_count(vertex_count),
+    index_count(index_count),
+    textures(textures),
+    lods(lods),
+    vao(GLVertexArray::generate()),
+    vbo(GLBuffer::generate()),
+    ebo(GLBuffer::generate()) {
+
+    // TODO: addTexture instead.
 
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBindVertexArray(vao.id());
+    glBindBuffer(GL_ARRAY_BUFFER, vbo.id());
     glBufferData(GL_ARRAY_BUFFER,
-                 sizeof(Vertex) * vertices.size(),
-                 vertices.data(),
+                 vertex_bytes(),
+                 vertices,
                  GL_STATIC_DRAW);
 
+    VertexFormat::of(layout).set_attributes();
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo.id());
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 index_bytes(),
+                 indices,
+                 GL_STATIC_DRAW);
+
+    glBindVertexArray(0);
+
+    if (this->lods.empty())
+      this->lods.push_back({0, (uint32_t)index_count, 0.0f});
+  }
+
+  VertexLayout get_layout() const { return layout; }
+
+  // size of the vertex and index buffers
+  size_t vertex_bytes() const {
+    return VertexFormat::of(layout).stride * vertex_count;
+  }
+  size_t index_bytes() const { return index_size(index_type) * index_count; }
+
+  size_t get_vertex_count() const { return vertex_count; }
+  // every level's indices
+  size_t get_index_count() const { return index_count; }
+
+  int lod_count() const { return lods.size(); }
+  const MeshLod& get_lod(int level) const { return lods[level]; }
+
+  // draws level of detail level, or the coarsest there is if the mesh has
+  // fewer. Returns number of draw calls made
+  int draw(Shader& shader, int level = 0) {
+    bind_textures(shader);
+    bind_morph_targets(shader);
+
+    glBindVertexArray(vao.id());
+    draw_elements(lods[std::min<int>(level, lods.size() - 1)]);
+    glBindVertexArray(0);
+
+    unbind_morph_targets(shader);
+    return 1;
+  }
+
+  // draws count copies in a single call, reading per-instance attributes from
+  // the buffer given to set_instance_buffer
+  int draw_instanced(Shader& shader, int count) {
+    bind_textures(shader);
+
+    glBindVertexArray(vao.id());
+    glDrawElementsInstanced(GL_TRIANGLES, lods[0].index_count, index_type, 0,
+                            count);
+    glBindVertexArray(0);
+    return 1;
+  }
+
+  // adds per-instance float attributes from buffer, starting at
+  // first_location with one attribute per entry of sizes (in floats)
+  void set_instance_buffer(unsigned int buffer, int first_location,
+                           const std::vector<int>& sizes, int stride) {
+    glBindVertexArray(vao.id());
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    size_t offset = 0;
+    for (size_t i = 0; i < sizes.size(); i++) {
+      glEnableVertexAttribArray(first_location + i);
+      glVertexAttribPointer(first_location + i,
+                            sizes[i],
+                            GL_FLOAT,
+                            GL_FALSE,
+                            stride,
+                            (void*)offset);
+      glVertexAttribDivisor(first_location + i, 1);
+      offset += sizes[i] * sizeof(float);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  // runs skinning_shader over every vertex once and captures its skinned
+  // position and normal with transform feedback, for draw_skinned to reuse
+  void skin(Shader& skinning_shader) {
+    if (!skinned_vao)
+      create_skinned_buffers();
+
+    bind_morph_targets(skinning_shader);
+    skinning_shader.bind();
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(vao.id());
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, skinned_vbo.id());
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, vertex_count);
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindVertexArray(0);
+    glDisable(GL_RASTERIZER_DISCARD);
+    unbind_morph_targets(skinning_shader);
+  }
+
+  // draws the vertices written by the last skin() as a static mesh
+  int draw_skinned(Shader& shader) {
+    bind_textures(shader);
+
+    glBindVertexArray(skinned_vao.id());
+    draw_elements(lods[0]);
+    glBindVertexArray(0);
+    return 1;
+  }
+
+  // blend shapes read from the mesh, null if it has none
+  void set_morph_targets(std::shared_ptr<MorphTargets> morph_targets) {
+    this->morph_targets = morph_targets;
+  }
+
+  MorphTargets* get_morph_targets() { return morph_targets.get(); }
+
+  // model space bounds of the vertices, in bind pose for skinned meshes
+  void set_bounds(const Bounds& bounds) { this->bounds = bounds; }
+  const Bounds& get_bounds() const { return bounds; }
+
+private:
+  void draw_elements(const MeshLod& lod) {
+    glDrawElements(GL_TRIANGLES, lod.index_count, index_type,
+                   (void*)(intptr_t)(lod.first_index * index_size(index_type)));
+  }
+
+  // units after the bone palette's
+  static constexpr int morph_texture_unit = 9;
+
+  void bind_morph_targets(Shader& shader) {
+    if (morph_targets)
+      morph_targets->bind(shader, morph_texture_unit);
+  }
+
+  void unbind_morph_targets(Shader& shader) {
+    if (morph_targets)
+      MorphTargets::unbind(shader);
+  }
+
+  // skinned position and normal per vertex, as written by transform feedback
+  struct SkinnedVertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+  };
+
+  void create_skinned_buffers() {
+    skinned_vao = GLVertexArray::generate();
+    skinned_vbo = GLBuffer::generate();
+
+    glBindVertexArray(skinned_vao.id());
+    glBindBuffer(GL_ARRAY_BUFFER, skinned_vbo.id());
+    glBufferData(GL_ARRAY_BUFFER,
+                 sizeof(SkinnedVertex) * vertex_count,
+                 NULL,
+                 GL_DYNAMIC_COPY);
 
     // position
     glEnableVertexAttribArray(0);
@@ -56,8 +238,8 @@ public:
                           3,
                           GL_FLOAT,
                           GL_FALSE,
-                          sizeof(Vertex),
-                          (void*)(offsetof(Vertex, position)));
+                          sizeof(SkinnedVertex),
+                          (void*)(offsetof(SkinnedVertex, position)));
 
     // normal
     glEnableVertexAttribArray(1);
@@ -65,45 +247,21 @@ public:
                           3,
                           GL_FLOAT,
                           GL_FALSE,
-                          sizeof(Vertex),
-                          (void*)(offsetof(Vertex, normal)));
+                          sizeof(SkinnedVertex),
+                          (void*)(offsetof(SkinnedVertex, normal)));
 
-    // texture coords
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2,
-                          2,
-                          GL_FLOAT,
-                          GL_FALSE,
-                          sizeof(Vertex),
-                          (void*)(offsetof(Vertex, textureCoords)));
-
-    // boneIds
-    glEnableVertexAttribArray(3);
-    glVertexAttribIPointer(3,
-                          MAX_BONE_WEIGHTS,
-                          GL_INT,
-                          sizeof(Vertex),
-                          (void*)(offsetof(Vertex, boneIds)));
-    // weights
-    glEnableVertexAttribArray(4);
-    glVertexAttribPointer(4,
-                          MAX_BONE_WEIGHTS,
-                          GL_FLOAT,
-                          GL_FALSE,
-                          sizeof(Vertex),
-                          (void*)(offsetof(Vertex, weights)));
+    // texture coords don't change with the pose, so they stay in the
+    // original buffer
+    glBindBuffer(GL_ARRAY_BUFFER, vbo.id());
+    VertexFormat::of(layout).set_texture_coords_attribute(2);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                 sizeof(unsigned int) * indices.size(),
-                 indices.data(),
-                 GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo.id());
 
     glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
   }
 
-  // returns number of draw calls made
-  int draw(Shader& shader) {
+  void bind_textures(Shader& shader) {
     unsigned int diffuse = 1;
     unsigned int specular = 1;
     for(unsigned int i = 0; i < textures.size(); i++) {
@@ -127,19 +285,23 @@ public:
       // shader.setInt(("material." + name + number).c_str(), i);
       glBindTexture(GL_TEXTURE_2D, textures[i].id);
     }
-
-    glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-    return 1;
   }
 
-private:
-  std::vector<Vertex> vertices;
-  std::vector<unsigned int> indices;
+  VertexLayout layout;
+  GLenum index_type;
+  size_t vertex_count;
+  size_t index_count;
   std::vector<Texture> textures;
+  std::vector<MeshLod> lods;
+  Bounds bounds;
+
+  GLVertexArray vao;
+  GLBuffer vbo, ebo;
+  // created by the first skin()
+  GLVertexArray skinned_vao;
+  GLBuffer skinned_vbo;
 
-  unsigned int vao, vbo, ebo;
+  std::shared_ptr<MorphTargets> morph_targets;
 
 };
 
@@ -0,0 +1,374 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "mesh_optimizer.hpp"
+
+namespace {
+
+// Forsyth's tuning: the last triangle's vertices score a flat 0.75, the rest
+// of the cache decays with position, and vertices with few triangles left
+// get a boost so they are finished off
+const int forsyth_cache_size = 32;
+
+float vertex_score(int cache_position, int remaining) {
+  if (remaining == 0)
+    return -1.0f;
+  float score = 0.0f;
+  if (cache_position >= 0) {
+    if (cache_position < 3) {
+      score = 0.75f;
+    } else {
+      float scale = 1.0f / (forsyth_cache_size - 3);
+      score = std::pow(1.0f - (cache_position - 3) * scale, 1.5f);
+    }
+  }
+  return score + 2.0f / std::sqrt((float)remaining);
+}
+
+// FIFO cache as found in hardware; returns whether vertex was a miss
+struct FifoCache {
+  std::vector<unsigned int> timestamps;
+  unsigned int time;
+  int size;
+
+  FifoCache(size_t vertex_count, int size)
+      : timestamps(vertex_count, 0), time(size + 1), size(size) {}
+
+  bool miss(unsigned int vertex) {
+    if (time - timestamps[vertex] <= (unsigned int)size)
+      return false;
+    timestamps[vertex] = time++;
+    return true;
+  }
+
+  void reset() { time += size + 1; }
+};
+
+glm::vec3 triangle_normal(const Vertex *vertices, const unsigned int *triangle) {
+  glm::vec3 a = vertices[triangle[0]].position;
+  glm::vec3 b = vertices[triangle[1]].position;
+  glm::vec3 c = vertices[triangle[2]].position;
+  return glm::cross(b - a, c - a); // length is twice the area
+}
+
+} // namespace
+
+VertexCacheStats analyze_vertex_cache(const unsigned int *indices,
+                                      size_t index_count, size_t vertex_count,
+                                      int cache_size) {
+  VertexCacheStats stats = {0.0f, 0.0f};
+  if (index_count < 3 || vertex_count == 0)
+    return stats;
+  FifoCache cache(vertex_count, cache_size);
+  std::vector<bool> used(vertex_count, false);
+  size_t misses = 0, unique = 0;
+  for (size_t i = 0; i < index_count; i++) {
+    if (cache.miss(indices[i]))
+      misses++;
+    if (!used[indices[i]]) {
+      used[indices[i]] = true;
+      unique++;
+    }
+  }
+  stats.acmr = (float)misses / (index_count / 3);
+  stats.atvr = (float)misses / unique;
+  return stats;
+}
+
+float analyze_overdraw(const unsigned int *indices, size_t index_count,
+                       const Vertex *vertices, size_t vertex_count) {
+  const int resolution = 256;
+  if (index_count < 3)
+    return 1.0f;
+
+  glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+  for (size_t i = 0; i < index_count; i++) {
+    min = glm::min(min, vertices[indices[i]].position);
+    max = glm::max(max, vertices[indices[i]].position);
+  }
+  glm::vec3 extent = glm::max(max - min, glm::vec3(1e-6f));
+
+  std::vector<float> depth(resolution * resolution);
+  size_t shaded = 0, covered = 0;
+  for (int view = 0; view < 6; view++) {
+    // looking down axis, from the positive or negative side
+    int axis = view / 2;
+    float facing = view % 2 == 0 ? 1.0f : -1.0f;
+    int u_axis = (axis + 1) % 3, v_axis = (axis + 2) % 3;
+    std::fill(depth.begin(), depth.end(), FLT_MAX);
+
+    for (size_t t = 0; t + 2 < index_count; t += 3) {
+      float x[3], y[3], z[3];
+      for (int k = 0; k < 3; k++) {
+        glm::vec3 p = (vertices[indices[t + k]].position - min) / extent;
+        x[k] = p[u_axis] * resolution;
+        y[k] = p[v_axis] * resolution;
+        z[k] = facing * p[axis];
+      }
+      float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+      if (std::fabs(area) < 1e-12f)
+        continue;
+
+      int x0 = std::max(0, (int)std::floor(std::min({x[0], x[1], x[2]})));
+      int x1 = std::min(resolution - 1, (int)std::ceil(std::max({x[0], x[1], x[2]})));
+      int y0 = std::max(0, (int)std::floor(std::min({y[0], y[1], y[2]})));
+      int y1 = std::min(resolution - 1, (int)std::ceil(std::max({y[0], y[1], y[2]})));
+      for (int py = y0; py <= y1; py++) {
+        for (int px = x0; px <= x1; px++) {
+          float cx = px + 0.5f, cy = py + 0.5f;
+          // barycentrics from edge functions, sign normalized by area
+          float w0 = ((x[2] - x[1]) * (cy - y[1]) - (y[2] - y[1]) * (cx - x[1])) / area;
+          float w1 = ((x[0] - x[2]) * (cy - y[2]) - (y[0] - y[2]) * (cx - x[2])) / area;
+          float w2 = 1.0f - w0 - w1;
+          if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+            continue;
+          float fragment_depth = w0 * z[0] + w1 * z[1] + w2 * z[2];
+          float &stored = depth[py * resolution + px];
+          if (fragment_depth >= stored)
+            continue;
+          if (stored == FLT_MAX)
+            covered++;
+          stored = fragment_depth;
+          shaded++;
+        }
+      }
+    }
+  }
+  return covered ? (float)shaded / covered : 1.0f;
+}
+
+void optimize_vertex_cache(unsigned int *indices, size_t index_count,
+                           size_t vertex_count) {
+  size_t triangle_count = index_count / 3;
+  if (triangle_count == 0)
+    return;
+
+  // triangles around each vertex; the first remaining[v] entries of a
+  // vertex's range are the ones not yet emitted
+  std::vector<int> remaining(vertex_count, 0);
+  for (size_t i = 0; i < triangle_count * 3; i++)
+    remaining[indices[i]]++;
+  std::vector<size_t> first(vertex_count + 1, 0);
+  for (size_t v = 0; v < vertex_count; v++)
+    first[v + 1] = first[v] + remaining[v];
+  std::vector<unsigned int> adjacency(triangle_count * 3);
+  std::vector<size_t> filled(first.begin(), first.end() - 1);
+  for (size_t t = 0; t < triangle_count; t++)
+    for (int k = 0; k < 3; k++)
+      adjacency[filled[indices[t * 3 + k]]++] = t;
+
+  std::vector<int> cache_position(vertex_count, -1);
+  std::vector<float> score(vertex_count);
+  for (size_t v = 0; v < vertex_count; v++)
+    score[v] = vertex_score(-1, remaining[v]);
+  std::vector<float> triangle_score(triangle_count);
+  std::vector<bool> emitted(triangle_count, false);
+  for (size_t t = 0; t < triangle_count; t++)
+    triangle_score[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] +
+                        score[indices[t * 3 + 2]];
+
+  std::vector<unsigned int> output;
+  output.reserve(triangle_count * 3);
+  std::vector<unsigned int> cache, next_cache;
+  size_t cursor = 0; // no triangle before this is left
+  long best = std::max_element(triangle_score.begin(), triangle_score.end()) -
+              triangle_score.begin();
+
+  while (output.size() < triangle_count * 3) {
+    if (best < 0) {
+      // nothing in the cache has triangles left, start somewhere new
+      while (emitted[cursor])
+        cursor++;
+      best = cursor;
+    }
+    const unsigned int *triangle = indices + best * 3;
+    emitted[best] = true;
+
+    next_cache.assign(triangle, triangle + 3);
+    for (int k = 0; k < 3; k++) {
+      unsigned int v = triangle[k];
+      output.push_back(v);
+      // move the emitted triangle past the remaining ones
+      size_t begin = first[v], end = begin + remaining[v];
+      for (size_t a = begin; a < end; a++) {
+        if (adjacency[a] == (unsigned int)best) {
+          std::swap(adjacency[a], adjacency[end - 1]);
+          break;
+        }
+      }
+      remaining[v]--;
+    }
+    for (unsigned int v : cache)
+      if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+        next_cache.push_back(v);
+    for (size_t i = forsyth_cache_size; i < next_cache.size(); i++) {
+      cache_position[next_cache[i]] = -1;
+      score[next_cache[i]] = vertex_score(-1, remaining[next_cache[i]]);
+    }
+    if (next_cache.size() > (size_t)forsyth_cache_size)
+      next_cache.resize(forsyth_cache_size);
+    for (size_t i = 0; i < next_cache.size(); i++) {
+      cache_position[next_cache[i]] = i;
+      score[next_cache[i]] = vertex_score(i, remaining[next_cache[i]]);
+    }
+    cache.swap(next_cache);
+
+    // only triangles touching the cache changed score
+    best = -1;
+    float best_score = -1.0f;
+    for (unsigned int v : cache) {
+      for (size_t a = first[v]; a < first[v] + remaining[v]; a++) {
+        unsigned int t = adjacency[a];
+        const unsigned int *other = indices + t * 3;
+        triangle_score[t] = score[other[0]] + score[other[1]] + score[other[2]];
+        if (triangle_score[t] > best_score) {
+          best_score = triangle_score[t];
+          best = t;
+        }
+      }
+    }
+  }
+  std::copy(output.begin(), output.end(), indices);
+}
+
+void optimize_overdraw(unsigned int *indices, size_t index_count,
+                       const Vertex *vertices, size_t vertex_count,
+                       float threshold) {
+  const int cache_size = 16;
+  size_t triangle_count = index_count / 3;
+  if (triangle_count < 2)
+    return;
+
+  // hard boundaries: triangles that miss on all three vertices start a new
+  // cluster, since the cache is as good as empty there anyway
+  FifoCache cache(vertex_count, cache_size);
+  std::vector<size_t> hard;
+  for (size_t t = 0; t < triangle_count; t++) {
+    int misses = 0;
+    for (int k = 0; k < 3; k++)
+      misses += cache.miss(indices[t * 3 + k]);
+    if (misses == 3)
+      hard.push_back(t);
+  }
+  if (hard.empty() || hard[0] != 0)
+    hard.insert(hard.begin(), 0);
+  hard.push_back(triangle_count);
+
+  // soft boundaries: within a hard cluster, split wherever the run so far
+  // is already within threshold of the cluster's own cache efficiency
+  std::vector<size_t> clusters;
+  for (size_t h = 0; h + 1 < hard.size(); h++) {
+    size_t begin = hard[h], end = hard[h + 1];
+    cache.reset();
+    size_t cluster_misses = 0;
+    for (size_t i = begin * 3; i < end * 3; i++)
+      cluster_misses += cache.miss(indices[i]);
+    float cluster_acmr = (float)cluster_misses / (end - begin);
+
+    cache.reset();
+    size_t start = begin, misses = 0;
+    clusters.push_back(begin);
+    for (size_t t = begin; t < end; t++) {
+      for (int k = 0; k < 3; k++)
+        misses += cache.miss(indices[t * 3 + k]);
+      if (t + 1 < end &&
+          (float)misses / (t + 1 - start) <= threshold * cluster_acmr) {
+        clusters.push_back(t + 1);
+        start = t + 1;
+        misses = 0;
+        cache.reset();
+      }
+    }
+  }
+  clusters.push_back(triangle_count);
+
+  glm::vec3 mesh_centroid(0.0f);
+  float mesh_area = 0.0f;
+  std::vector<float> keys(clusters.size() - 1);
+  std::vector<glm::vec3> centroids(keys.size()), normals(keys.size());
+  for (size_t c = 0; c + 1 < clusters.size(); c++) {
+    glm::vec3 centroid(0.0f), normal(0.0f);
+    float area = 0.0f;
+    for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+      const unsigned int *triangle = indices + t * 3;
+      glm::vec3 n = triangle_normal(vertices, triangle);
+      float a = glm::length(n);
+      centroid += (vertices[triangle[0]].position +
+                   vertices[triangle[1]].position +
+                   vertices[triangle[2]].position) * (a / 3.0f);
+      normal += n;
+      area += a;
+    }
+    mesh_centroid += centroid;
+    mesh_area += area;
+    centroids[c] = area > 0.0f ? centroid / area : centroid;
+    float length = glm::length(normal);
+    normals[c] = length > 0.0f ? normal / length : normal;
+  }
+  if (mesh_area > 0.0f)
+    mesh_centroid /= mesh_area;
+
+  // clusters facing away from the middle of the mesh are drawn first, as
+  // they are the ones most likely to be in front
+  std::vector<size_t> order(keys.size());
+  for (size_t c = 0; c < keys.size(); c++) {
+    keys[c] = glm::dot(centroids[c] - mesh_centroid, normals[c]);
+    order[c] = c;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&](size_t a, size_t b) { return keys[a] > keys[b]; });
+
+  std::vector<unsigned int> output;
+  output.reserve(triangle_count * 3);
+  for (size_t c : order)
+    output.insert(output.end(), indices + clusters[c] * 3,
+                  indices + clusters[c + 1] * 3);
+  std::copy(output.begin(), output.end(), indices);
+}
+
+size_t optimize_vertex_fetch(Vertex *vertices, unsigned int *indices,
+                             size_t index_count, size_t vertex_count) {
+  const unsigned int unused = ~0u;
+  std::vector<unsigned int> remap(vertex_count, unused);
+  unsigned int next = 0;
+  for (size_t i = 0; i < index_count; i++) {
+    unsigned int &target = remap[indices[i]];
+    if (target == unused)
+      target = next++;
+    indices[i] = target;
+  }
+
+  std::vector<Vertex> reordered(next);
+  for (size_t v = 0; v < vertex_count; v++)
+    if (remap[v] != unused)
+      reordered[remap[v]] = vertices[v];
+  std::copy(reordered.begin(), reordered.end(), vertices);
+  return next;
+}
+
+MeshOptimizationReport optimize_mesh(const std::string &name,
+                                     std::vector<Vertex> &vertices,
+                                     std::vector<unsigned int> &indices,
+                                     bool reorder_vertices) {
+  MeshOptimizationReport report;
+  report.name = name;
+  report.triangles = indices.size() / 3;
+  report.cache_before =
+      analyze_vertex_cache(indices.data(), indices.size(), vertices.size());
+  report.overdraw_before = analyze_overdraw(indices.data(), indices.size(),
+                                            vertices.data(), vertices.size());
+
+  optimize_vertex_cache(indices.data(), indices.size(), vertices.size());
+  optimize_overdraw(indices.data(), indices.size(), vertices.data(),
+                    vertices.size());
+  if (reorder_vertices)
+    vertices.resize(optimize_vertex_fetch(vertices.data(), indices.data(),
+                                          indices.size(), vertices.size()));
+
+  report.cache_after =
+      analyze_vertex_cache(indices.data(), indices.size(), vertices.size());
+  report.overdraw_after = analyze_overdraw(indices.data(), indices.size(),
+                                           vertices.data(), vertices.size());
+  return report;
+}
@@ -0,0 +1,67 @@
+#ifndef MESH_OPTIMIZER_HPP
+#define MESH_OPTIMIZER_HPP
+
+#include <string>
+#include <vector>
+
+#include "vertex_format.hpp"
+
+/* reordering passes run on meshes as they are imported. None of them change
+what is drawn, only the order triangles and vertices arrive in:
+
+- optimize_vertex_cache orders triangles so recently transformed vertices
+  are reused (Forsyth's linear-speed vertex cache optimisation)
+- optimize_overdraw then sorts runs of those triangles so outward facing
+  ones come first, without giving up much of the cache efficiency (Sander,
+  Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and
+  Reduced Overdraw")
+- optimize_vertex_fetch renumbers vertices in the order the triangles first
+  use them, so vertex fetch walks the buffer forwards */
+
+// post-transform cache efficiency of an index buffer, measured with a FIFO
+// cache of cache_size vertices
+struct VertexCacheStats {
+  float acmr; // transformed vertices per triangle, 0.5 at best and 3 at worst
+  float atvr; // transformed vertices per vertex, 1 at best
+};
+
+VertexCacheStats analyze_vertex_cache(const unsigned int *indices,
+                                      size_t index_count, size_t vertex_count,
+                                      int cache_size = 16);
+
+// fragments shaded per pixel covered, averaged over orthographic views
+// along the six axis directions. 1 means no overdraw
+float analyze_overdraw(const unsigned int *indices, size_t index_count,
+                       const Vertex *vertices, size_t vertex_count);
+
+void optimize_vertex_cache(unsigned int *indices, size_t index_count,
+                           size_t vertex_count);
+
+// expects indices already through optimize_vertex_cache. threshold is how
+// much worse than the input's ACMR each reordered cluster may get
+void optimize_overdraw(unsigned int *indices, size_t index_count,
+                       const Vertex *vertices, size_t vertex_count,
+                       float threshold = 1.05f);
+
+// reorders vertices in place and rewrites indices to match. Vertices no
+// triangle uses are dropped; returns the new vertex count
+size_t optimize_vertex_fetch(Vertex *vertices, unsigned int *indices,
+                             size_t index_count, size_t vertex_count);
+
+// statistics for one mesh before and after optimize_mesh
+struct MeshOptimizationReport {
+  std::string name;
+  size_t triangles;
+  VertexCacheStats cache_before, cache_after;
+  float overdraw_before, overdraw_after;
+};
+
+/* runs all three passes. reorder_vertices is false for meshes whose vertex
+order something else depends on, such as blend shapes built from the
+source mesh */
+MeshOptimizationReport optimize_mesh(const std::string &name,
+                                     std::vector<Vertex> &vertices,
+                                     std::vector<unsigned int> &indices,
+                                     bool reorder_vertices);
+
+#endif
@@ -0,0 +1,367 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_set>
+
+#include "mesh_optimizer.hpp"
+#include "mesh_simplifier.hpp"
+
+namespace {
+
+// how much more an open border resists being pulled inwards than the
+// surface does sideways
+const float border_weight = 10.0f;
+
+// symmetric 4x4 matrix summing the squared distances to a set of planes,
+// each weighted by the area it came from
+struct Quadric {
+  double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+  double b0 = 0, b1 = 0, b2 = 0, c = 0;
+  double weight = 0;
+
+  // the plane through point with unit normal n
+  static Quadric plane(const glm::vec3 &n, const glm::vec3 &point, float w) {
+    double d = -(n.x * point.x + n.y * point.y + n.z * point.z);
+    Quadric q;
+    q.a00 = w * n.x * n.x;
+    q.a01 = w * n.x * n.y;
+    q.a02 = w * n.x * n.z;
+    q.a11 = w * n.y * n.y;
+    q.a12 = w * n.y * n.z;
+    q.a22 = w * n.z * n.z;
+    q.b0 = w * n.x * d;
+    q.b1 = w * n.y * d;
+    q.b2 = w * n.z * d;
+    q.c = w * d * d;
+    q.weight = w;
+    return q;
+  }
+
+  void add(const Quadric &o) {
+    a00 += o.a00;
+    a01 += o.a01;
+    a02 += o.a02;
+    a11 += o.a11;
+    a12 += o.a12;
+    a22 += o.a22;
+    b0 += o.b0;
+    b1 += o.b1;
+    b2 += o.b2;
+    c += o.c;
+    weight += o.weight;
+  }
+
+  // weighted mean squared distance from p to the planes
+  double error(const glm::vec3 &p) const {
+    double x = p.x, y = p.y, z = p.z;
+    double sum = a00 * x * x + a11 * y * y + a22 * z * z +
+                 2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                 2 * (b0 * x + b1 * y + b2 * z) + c;
+    return weight > 0 ? std::fabs(sum) / weight : 0.0;
+  }
+};
+
+enum class VertexKind {
+  manifold, // free to move onto any neighbour
+  border,   // on an open edge, only moves along it
+  locked,   // shares its position with another vertex
+};
+
+struct Collapse {
+  unsigned int from, to;
+  double error;
+};
+
+// triangles using each vertex, as offsets into one list
+struct Adjacency {
+  std::vector<unsigned int> offsets;
+  std::vector<unsigned int> triangles;
+
+  Adjacency(const std::vector<unsigned int> &indices, size_t vertex_count)
+      : offsets(vertex_count + 1, 0), triangles(indices.size()) {
+    for (unsigned int index : indices)
+      offsets[index + 1]++;
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector<unsigned int> next(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+      triangles[next[indices[i]]++] = i / 3;
+  }
+
+  const unsigned int *begin(unsigned int vertex) const {
+    return triangles.data() + offsets[vertex];
+  }
+  const unsigned int *end(unsigned int vertex) const {
+    return triangles.data() + offsets[vertex + 1];
+  }
+};
+
+uint64_t edge_key(unsigned int a, unsigned int b) {
+  return (uint64_t)a << 32 | b;
+}
+
+/* the first of the vertices identical to each vertex in every attribute.
+Imports without aiProcess_JoinIdenticalVertices give each triangle corner a
+vertex of its own; simplification sees those as one vertex, or every edge
+would look open */
+std::vector<unsigned int> canonical_vertices(const Vertex *vertices,
+                                             size_t vertex_count) {
+  // Vertex has no padding, so its bytes compare like its attributes
+  auto vertex_less = [vertices](unsigned int a, unsigned int b) {
+    int order = std::memcmp(&vertices[a], &vertices[b], sizeof(Vertex));
+    return order != 0 ? order < 0 : a < b;
+  };
+  std::vector<unsigned int> order(vertex_count);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), vertex_less);
+
+  std::vector<unsigned int> canonical(vertex_count);
+  for (size_t i = 0; i < vertex_count; i++) {
+    bool same = i > 0 && std::memcmp(&vertices[order[i - 1]],
+                                     &vertices[order[i]], sizeof(Vertex)) == 0;
+    canonical[order[i]] = same ? canonical[order[i - 1]] : order[i];
+  }
+  return canonical;
+}
+
+// every directed edge of the triangles. An edge is open when no triangle
+// runs along it the other way
+std::unordered_set<uint64_t> directed_edges(
+    const std::vector<unsigned int> &indices) {
+  std::unordered_set<uint64_t> edges;
+  for (size_t i = 0; i < indices.size(); i += 3)
+    for (int k = 0; k < 3; k++)
+      edges.insert(edge_key(indices[i + k], indices[i + (k + 1) % 3]));
+  return edges;
+}
+
+std::vector<VertexKind> classify(const Vertex *vertices, size_t vertex_count,
+                                 const std::vector<unsigned int> &indices,
+                                 const std::unordered_set<uint64_t> &edges) {
+  std::vector<VertexKind> kinds(vertex_count, VertexKind::manifold);
+  for (size_t i = 0; i < indices.size(); i += 3)
+    for (int k = 0; k < 3; k++) {
+      unsigned int a = indices[i + k], b = indices[i + (k + 1) % 3];
+      if (edges.find(edge_key(b, a)) == edges.end())
+        kinds[a] = kinds[b] = VertexKind::border;
+    }
+
+  std::vector<unsigned int> order(indices);
+  std::sort(order.begin(), order.end());
+  order.erase(std::unique(order.begin(), order.end()), order.end());
+  auto position_less = [vertices](unsigned int a, unsigned int b) {
+    const glm::vec3 &p = vertices[a].position, &q = vertices[b].position;
+    if (p.x != q.x)
+      return p.x < q.x;
+    if (p.y != q.y)
+      return p.y < q.y;
+    return p.z < q.z;
+  };
+  std::sort(order.begin(), order.end(), position_less);
+  for (size_t i = 1; i < order.size(); i++)
+    if (!position_less(order[i - 1], order[i]))
+      kinds[order[i - 1]] = kinds[order[i]] = VertexKind::locked;
+  return kinds;
+}
+
+std::vector<Quadric> surface_quadrics(const Vertex *vertices,
+                                      size_t vertex_count,
+                                      const std::vector<unsigned int> &indices,
+                                      const std::unordered_set<uint64_t> &edges) {
+  std::vector<Quadric> quadrics(vertex_count);
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    glm::vec3 p[3];
+    for (int k = 0; k < 3; k++)
+      p[k] = vertices[indices[i + k]].position;
+    glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+    float area = glm::length(normal) * 0.5f;
+    if (area == 0.0f)
+      continue;
+    normal /= area * 2.0f;
+    Quadric q = Quadric::plane(normal, p[0], area);
+    for (int k = 0; k < 3; k++)
+      quadrics[indices[i + k]].add(q);
+
+    // borders get a plane standing on the edge, at right angles to the
+    // triangle, so moving them off the edge costs more than along it
+    for (int k = 0; k < 3; k++) {
+      unsigned int a = indices[i + k], b = indices[i + (k + 1) % 3];
+      if (edges.find(edge_key(b, a)) != edges.end())
+        continue;
+      glm::vec3 edge = p[(k + 1) % 3] - p[k];
+      float length = glm::length(edge);
+      if (length == 0.0f)
+        continue;
+      glm::vec3 side = glm::cross(edge / length, normal);
+      Quadric border =
+          Quadric::plane(side, p[k], length * length * border_weight);
+      quadrics[a].add(border);
+      quadrics[b].add(border);
+    }
+  }
+  return quadrics;
+}
+
+// whether moving from onto to turns any of from's other triangles over
+bool flips(const Vertex *vertices, const std::vector<unsigned int> &indices,
+           const Adjacency &adjacency, unsigned int from, unsigned int to) {
+  for (const unsigned int *t = adjacency.begin(from); t != adjacency.end(from);
+       t++) {
+    const unsigned int *triangle = &indices[*t * 3];
+    if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+      continue; // collapses away
+    glm::vec3 before[3], after[3];
+    for (int k = 0; k < 3; k++) {
+      before[k] = vertices[triangle[k]].position;
+      after[k] = vertices[triangle[k] == from ? to : triangle[k]].position;
+    }
+    glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+    glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+    if (glm::dot(n0, n1) <= 0.25f * glm::length(n0) * glm::length(n1))
+      return true;
+  }
+  return false;
+}
+
+} // namespace
+
+std::vector<unsigned int> simplify_mesh(const Vertex *vertices,
+                                        size_t vertex_count,
+                                        const unsigned int *indices,
+                                        size_t index_count,
+                                        size_t target_index_count,
+                                        float max_error, float *error) {
+  std::vector<unsigned int> result(indices, indices + index_count);
+  *error = 0.0f;
+  if (index_count == 0)
+    return result;
+
+  glm::vec3 low = vertices[indices[0]].position, high = low;
+  for (size_t i = 0; i < index_count; i++) {
+    low = glm::min(low, vertices[indices[i]].position);
+    high = glm::max(high, vertices[indices[i]].position);
+  }
+  double error_limit = max_error * glm::length(high - low) * 0.5f;
+  error_limit *= error_limit;
+
+  std::vector<unsigned int> canonical =
+      canonical_vertices(vertices, vertex_count);
+  for (unsigned int &index : result)
+    index = canonical[index];
+
+  std::unordered_set<uint64_t> edges = directed_edges(result);
+  std::vector<VertexKind> kinds =
+      classify(vertices, vertex_count, result, edges);
+  std::vector<Quadric> quadrics =
+      surface_quadrics(vertices, vertex_count, result, edges);
+  double worst = 0.0;
+
+  // each pass collapses the cheapest edges whose neighbourhoods don't
+  // overlap, so the costs and flip checks of a pass never go stale
+  while (result.size() > target_index_count) {
+    Adjacency adjacency(result, vertex_count);
+
+    std::vector<Collapse> collapses;
+    for (size_t i = 0; i < result.size(); i += 3)
+      for (int k = 0; k < 3; k++) {
+        unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+        for (int direction = 0; direction < 2; direction++) {
+          unsigned int from = direction ? b : a, to = direction ? a : b;
+          if (kinds[from] == VertexKind::locked ||
+              (kinds[from] == VertexKind::border &&
+               kinds[to] == VertexKind::manifold))
+            continue;
+          Quadric q = quadrics[from];
+          q.add(quadrics[to]);
+          collapses.push_back({from, to, q.error(vertices[to].position)});
+        }
+      }
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse &a, const Collapse &b) {
+                return a.error < b.error;
+              });
+
+    std::vector<unsigned int> remap(vertex_count);
+    std::iota(remap.begin(), remap.end(), 0);
+    std::vector<bool> touched(vertex_count, false);
+    size_t triangles = result.size() / 3;
+    size_t collapsed = 0;
+    for (const Collapse &collapse : collapses) {
+      if (triangles <= target_index_count / 3 || collapse.error > error_limit)
+        break;
+      unsigned int from = collapse.from, to = collapse.to;
+      if (touched[from] || touched[to])
+        continue;
+
+      size_t shared = 0;
+      for (const unsigned int *t = adjacency.begin(from);
+           t != adjacency.end(from); t++) {
+        const unsigned int *triangle = &result[*t * 3];
+        if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+          shared++;
+      }
+      // a border vertex may only slide along an open edge
+      if (shared == 0 || (kinds[from] == VertexKind::border && shared != 1))
+        continue;
+      if (flips(vertices, result, adjacency, from, to))
+        continue;
+
+      remap[from] = to;
+      quadrics[to].add(quadrics[from]);
+      for (const unsigned int *t = adjacency.begin(from);
+           t != adjacency.end(from); t++)
+        for (int k = 0; k < 3; k++)
+          touched[result[*t * 3 + k]] = true;
+      triangles -= shared;
+      worst = std::max(worst, collapse.error);
+      collapsed++;
+    }
+    if (collapsed == 0)
+      break;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      unsigned int a = remap[result[i]], b = remap[result[i + 1]],
+                   c = remap[result[i + 2]];
+      if (a == b || b == c || c == a)
+        continue;
+      result[kept++] = a;
+      result[kept++] = b;
+      result[kept++] = c;
+    }
+    result.resize(kept);
+  }
+
+  *error = (float)std::sqrt(worst);
+  return result;
+}
+
+std::vector<MeshLod> build_lod_chain(const Vertex *vertices,
+                                     size_t vertex_count,
+                                     std::vector<unsigned int> &indices,
+                                     const std::vector<float> &ratios,
+                                     float max_error, bool optimize) {
+  std::vector<MeshLod> lods = {{0, (uint32_t)indices.size(), 0.0f}};
+  size_t full_triangles = indices.size() / 3;
+  std::vector<unsigned int> previous(indices);
+  float error = 0.0f;
+  for (float ratio : ratios) {
+    size_t target = (size_t)(full_triangles * ratio) * 3;
+    float level_error;
+    std::vector<unsigned int> level =
+        simplify_mesh(vertices, vertex_count, previous.data(), previous.size(),
+                      target, max_error, &level_error);
+    // not worth another range, and coarser targets would stall the same way
+    if (level.empty() || level.size() > previous.size() * 0.9f)
+      break;
+    if (optimize)
+      optimize_vertex_cache(level.data(), level.size(), vertex_count);
+
+    // each level is simplified from the last, so their errors add up
+    error += level_error;
+    lods.push_back({(uint32_t)indices.size(), (uint32_t)level.size(), error});
+    indices.insert(indices.end(), level.begin(), level.end());
+    previous = std::move(level);
+  }
+  return lods;
+}
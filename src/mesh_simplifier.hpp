@@ -0,0 +1,49 @@
+#ifndef MESH_SIMPLIFIER_HPP
+#define MESH_SIMPLIFIER_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "vertex_format.hpp"
+
+/* coarser versions of a mesh for drawing it far away. Simplification only
+ever removes triangles and renumbers none of the vertices, so every level of
+detail indexes the full mesh's vertex buffer and a mesh keeps all of its
+levels in one index buffer, one range after the other.
+
+simplify_mesh collapses edges in order of their quadric error (Garland and
+Heckbert, "Surface Simplification Using Quadric Error Metrics"), each vertex
+moving onto one of its neighbours. Vertices on an open border only slide
+along it, and vertices sharing a position with another vertex (texture or
+normal seams) stay where they are, so no cracks open up */
+
+// a range of a mesh's index buffer that draws it at one level of detail
+struct MeshLod {
+  uint32_t first_index;
+  uint32_t index_count;
+  float error; // how far the level strays from the full mesh, in model units
+};
+
+/* indices for the triangles left after collapsing edges until at most
+target_index_count indices remain, or until the next collapse would move the
+surface further than max_error times the mesh's radius. error is set to the
+furthest any collapse moved it */
+std::vector<unsigned int> simplify_mesh(const Vertex *vertices,
+                                        size_t vertex_count,
+                                        const unsigned int *indices,
+                                        size_t index_count,
+                                        size_t target_index_count,
+                                        float max_error, float *error);
+
+/* appends one level per entry of ratios (fractions of the full triangle
+count, coarsest last) to indices, each simplified from the one before. The
+chain stops early once a level barely shrinks. Returns the ranges, level 0
+being the full mesh already in indices. optimize runs each new level through
+optimize_vertex_cache */
+std::vector<MeshLod> build_lod_chain(const Vertex *vertices,
+                                     size_t vertex_count,
+                                     std::vector<unsigned int> &indices,
+                                     const std::vector<float> &ratios,
+                                     float max_error, bool optimize);
+
+#endif
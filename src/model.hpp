@@ -1,8 +1,12 @@
 #ifndef MODEL_HPP
 #define MODEL_HPP
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <glm/ext/vector_float3.hpp>
 #include <map>
+#include <memory>
 #include <stb/stb_image.h>
 #include <string>
 #include <vector>
@@ -11,21 +15,95 @@
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 
+#include "asset_loader.hpp"
+#include "binary_cache.hpp"
+#include "bounds.hpp"
 #include "camera.hpp"
+#include "helpers.hpp"
 #include "mesh.hpp"
+#include "mesh_optimizer.hpp"
+#include "mesh_simplifier.hpp"
 #include "shader.hpp"
+#include "texture_cache.hpp"
 
 struct BoneInfo {
   int id;
   glm::mat4 offset;
 };
 
-class Model {
+// a node of the imported scene graph, parents before children
+struct ModelNode {
+  std::string name;
+  glm::mat4 transformation;
+  int parent; // -1 for the root
+};
+
+/* how a model file is turned into an asset. Part of the ModelCache key and
+of the binary cache header, so a change to any of it imports again */
+struct ImportOptions {
+  unsigned int flags = aiProcess_Triangulate | aiProcess_FlipUVs;
+  // reorder each mesh for the vertex cache, overdraw and vertex fetch (see
+  // mesh_optimizer.hpp)
+  bool optimize_meshes = true;
+  // triangle count of each level of detail after the full mesh, as a
+  // fraction of the full count (see mesh_simplifier.hpp). Empty for none
+  std::vector<float> lod_ratios = {0.5f, 0.25f, 0.1f};
+  // furthest simplification may move the surface per level, as a fraction
+  // of the mesh's radius. Levels stop short of their ratio rather than go
+  // past it
+  float lod_max_error = 0.05f;
+
+  std::string key() const {
+    std::string key = std::to_string(flags) + (optimize_meshes ? "o" : "");
+    for (float ratio : lod_ratios)
+      key += "l" + std::to_string(ratio);
+    return key + "e" + std::to_string(lod_max_error);
+  }
+};
+
+/* everything imported from a model file: GPU meshes, their textures and
+the skinning data. Assets are shared, so any number of Model instances can
+draw the same meshes, each with its own transform and shaders.
+
+Loading happens in stages so the slow part can leave the GL thread: read()
+and decode_images() only fill in CPU side data, and upload() then creates
+the buffers and textures. read() prefers a binary cache next to the source
+file (see write_cache), which keeps vertices and indices packed exactly as
+the buffers hold them, so a warm start maps the file and uploads from the
+mapping without going through Assimp or processMesh.
+
+Each mesh is packed into the smallest VertexLayout that holds it (no bone
+data for meshes no bone moves) and gets 16 bit indices when it has few
+enough vertices */
+class ModelAsset {
 public:
-  Model(Shader shader, const std::string &file_path) : shader(shader) {
-    Assimp::Importer importer;
-    const aiScene *scene =
-        importer.ReadFile(file_path, aiProcess_Triangulate | aiProcess_FlipUVs);
+  // bump whenever the layout of the cache file or of Vertex changes
+  static constexpr uint32_t cache_version = 5;
+  static constexpr uint32_t cache_magic = 0x4853454d; // "MESH"
+
+  // builds the asset from a scene the caller imported, all on this thread.
+  // options.flags doesn't apply, the scene is already imported
+  ModelAsset(const aiScene *scene, const std::string &file_path,
+             const ImportOptions &options = ImportOptions())
+      : ModelAsset(file_path, options) {
+    readScene(scene);
+    decode_images();
+    upload();
+  }
+
+  // an empty asset for read() to fill in. Nothing is drawn until upload()
+  explicit ModelAsset(const std::string &file_path,
+                      const ImportOptions &options = ImportOptions())
+      : file_path(file_path), options(options) {
+    dir = file_path.substr(0, file_path.find_last_of("/"));
+    bone_counter = 0;
+  }
+
+  // reads file_path with flags. The scene lives as long as importer does
+  static const aiScene *import_scene(Assimp::Importer &importer,
+                                     const std::string &file_path,
+                                     unsigned int flags = ImportOptions().flags) {
+    const aiScene *scene = importer.ReadFile(file_path, flags);
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
         !scene->mRootNode) {
       std::ostringstream error_message;
@@ -33,64 +111,230 @@ public:
                     << importer.GetErrorString();
       throw std::logic_error(error_message.str());
     }
-    dir = file_path.substr(0, file_path.find_last_of("/"));
-    processNode(scene->mRootNode, scene);
-
-    angle = 0;
-    scale = glm::vec3(1.0f);
-    position = glm::vec3(0.0f);
-    axis = glm::vec3(1.0f, 0, 0);
+    return scene;
   }
 
-  int draw(Camera &camera, bool shadow = false) {
-    glm::mat4 model(1.0f);
-    model = glm::translate(model, position);
-    model = glm::scale(model, scale);
-    model = glm::rotate(model, angle, axis);
-    if (shadow) {
-      shadow_shader.setMat4("model", model);
-      for (int i = 0; i < meshes.size(); i++)
-          meshes[i].draw(shadow_shader);
-    }
-    else {
-      shader.setMat4("projection", camera.projection());
-      shader.setMat4("view", camera.view());
-      shader.setMat4("model", model);
+  static std::string cache_path(const std::string &file_path) {
+    return file_path + ".meshcache";
+  }
 
-      for (int i = 0; i < meshes.size(); i++)
-          meshes[i].draw(shader);
-    }
-    return 0;
+  /* fills in everything but the GL objects, from the cache file if it is up
+  to date and use_cache is set, otherwise by importing the source with
+  Assimp. Touches no GL state, so it may run on any thread. Returns whether
+  the cache was used */
+  bool read(bool use_cache = true) {
+    if (use_cache && readCache())
+      return true;
+    importer = std::make_unique<Assimp::Importer>();
+    readScene(import_scene(*importer, file_path, options.flags));
+    return false;
   }
 
-  void set_pos(float x, float y, float z) { position = glm::vec3(x, y, z); }
+  // the scene read() imported, until upload() releases it. Null if the asset
+  // came from the cache
+  const aiScene *scene() const {
+    return importer ? importer->GetScene() : nullptr;
+  }
 
-  void set_scale(float x, float y, float z) { scale = glm::vec3(x, y, z); }
+  /* writes the cache file for the data read() or the scene constructor
+  filled in, so it must run before upload(). No GL, like read(). Returns
+  false, leaving no cache behind, if the file can't be written or if a mesh
+  has blend shapes, which the cache doesn't hold */
+  bool write_cache() {
+    for (const MeshData &data : mesh_data)
+      if (data.morph_source)
+        return false;
+
+    // written under a temporary name first, so a crash halfway never leaves
+    // a truncated cache where the next run would look for it
+    std::string path = cache_path(file_path);
+    std::string temporary_path = path + ".tmp";
+    bool written;
+    {
+      BinaryWriter writer(temporary_path);
+      writer.write<uint32_t>(cache_magic);
+      writer.write<uint32_t>(cache_version);
+      writer.write<uint32_t>(options.flags);
+      writer.write<uint32_t>(options.optimize_meshes);
+      writer.write(SourceStamp::of(file_path));
+      writer.write<uint32_t>(options.lod_ratios.size());
+      for (float ratio : options.lod_ratios)
+        writer.write(ratio);
+      writer.write(options.lod_max_error);
+
+      writer.write<int32_t>(bone_counter);
+      writer.write<uint32_t>(bone_info_map.size());
+      for (const auto &bone : bone_info_map) {
+        writer.write_string(bone.first);
+        writer.write<int32_t>(bone.second.id);
+        writer.write(bone.second.offset);
+      }
+      writer.write<uint32_t>(bone_bounds.size());
+      writer.write_array(bone_bounds.data(), bone_bounds.size());
+      writer.write(unskinned_bounds);
+
+      writer.write<uint32_t>(nodes.size());
+      for (const ModelNode &node : nodes) {
+        writer.write_string(node.name);
+        writer.write(node.transformation);
+        writer.write<int32_t>(node.parent);
+      }
 
-  void set_angle(float angle, glm::vec3 axis) {
-    this->angle = glm::radians(angle);
-    this->axis = axis;
+      writer.write<uint32_t>(mesh_data.size());
+      for (const MeshData &data : mesh_data) {
+        writer.write<uint32_t>(data.textures.size());
+        for (const Texture &texture : data.textures) {
+          writer.write_string(texture.type);
+          writer.write_string(texture.path);
+        }
+        writer.write<uint32_t>(static_cast<uint32_t>(data.layout));
+        writer.write<uint32_t>(data.vertex_count);
+        writer.write_array(
+            static_cast<const unsigned char *>(data.vertices),
+            VertexFormat::of(data.layout).stride * data.vertex_count);
+        writer.write<uint32_t>(data.index_type);
+        writer.write<uint32_t>(data.index_count);
+        writer.write_array(static_cast<const unsigned char *>(data.indices),
+                           index_size(data.index_type) * data.index_count);
+        writer.write<uint32_t>(data.lods.size());
+        writer.write_array(data.lods.data(), data.lods.size());
+        writer.write(data.bounds);
+      }
+      written = writer.ok();
+    }
+    if (!written || std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+      std::remove(temporary_path.c_str());
+      return false;
+    }
+    return true;
   }
 
-  Shader shader;
-  Shader shadow_shader;
+  // decodes every texture the meshes use that no model has decoded yet,
+  // into the shared TextureCache. No GL
+  void decode_images() {
+    for (const MeshData &data : mesh_data)
+      for (const Texture &texture : data.textures)
+        TextureCache::shared().prefetch(dir + '/' + texture.path,
+                                        texture_params);
+  }
 
-  std::map<std::string, BoneInfo> &get_bone_info_map() { return bone_info_map; }
-  int bone_count() { return bone_counter; }
+  // creates the meshes and textures from what read() and decode_images()
+  // left behind, then frees it. GL thread only
+  void upload() {
+    for (const MeshData &data : mesh_data) {
+      std::vector<Texture> textures;
+      for (const Texture &texture : data.textures)
+        textures.push_back(loadTexture(texture.path, texture.type));
+      meshes.emplace_back(data.layout, data.vertices, data.vertex_count,
+                          data.index_type, data.indices, data.index_count,
+                          textures, data.lods);
+      if (data.morph_source)
+        meshes.back().set_morph_targets(
+            std::make_shared<MorphTargets>(data.morph_source));
+      meshes.back().set_bounds(data.bounds);
+      bounds.expand(data.bounds);
+    }
 
-  glm::vec3 position;
-private:
-  glm::vec3 scale;
-  float angle;
-  glm::vec3 axis;
+    lod_errors.clear();
+    for (const Mesh &mesh : meshes)
+      if (mesh.lod_count() > (int)lod_errors.size())
+        lod_errors.resize(mesh.lod_count(), 0.0f);
+    for (size_t level = 0; level < lod_errors.size(); level++)
+      for (const Mesh &mesh : meshes) {
+        int last = mesh.lod_count() - 1;
+        lod_errors[level] = std::max(
+            lod_errors[level], mesh.get_lod(std::min<int>(level, last)).error);
+      }
+    mesh_data.clear();
+    mapping.reset();
+    importer.reset();
+  }
 
   std::vector<Mesh> meshes;
-  std::string dir;
-  std::vector<Texture> textures_loaded;
 
   std::map<std::string, BoneInfo> bone_info_map;
   int bone_counter;
 
+  // bind space box around the vertices each bone id influences, and around
+  // the vertices no bone moves
+  std::vector<AABB> bone_bounds;
+  AABB unskinned_bounds;
+
+  std::vector<ModelNode> nodes;
+
+  // model space bounds of every mesh together, in bind pose. Empty until
+  // upload()
+  Bounds bounds;
+
+  // error of each level of detail over all meshes, in model units. A mesh
+  // with fewer levels draws its coarsest in their place
+  std::vector<float> lod_errors;
+
+  // one per mesh imported with optimize_meshes set. Empty when the asset
+  // came from the cache, which holds the meshes already optimized
+  std::vector<MeshOptimizationReport> optimization_reports;
+
+  // totals over the uploaded meshes
+  size_t vertex_count() const {
+    size_t count = 0;
+    for (const Mesh &mesh : meshes)
+      count += mesh.get_vertex_count();
+    return count;
+  }
+  size_t index_count() const {
+    size_t count = 0;
+    for (const Mesh &mesh : meshes)
+      count += mesh.get_index_count();
+    return count;
+  }
+  size_t vertex_bytes() const {
+    size_t bytes = 0;
+    for (const Mesh &mesh : meshes)
+      bytes += mesh.vertex_bytes();
+    return bytes;
+  }
+  // tells texture streaming the meshes' textures are drawn this frame
+  void touch_textures() const {
+    for (const TextureCache::Handle &texture : texture_handles)
+      TextureCache::shared().touch(texture);
+  }
+
+  size_t index_bytes() const {
+    size_t bytes = 0;
+    for (const Mesh &mesh : meshes)
+      bytes += mesh.index_bytes();
+    return bytes;
+  }
+
+private:
+  std::string file_path;
+  ImportOptions options;
+  std::string dir;
+  // keeps the cached textures behind the meshes' ids alive, one per use
+  std::vector<TextureCache::Handle> texture_handles;
+  static inline const TextureParams texture_params = {};
+
+  // one mesh between read() and upload(), already packed. The arrays point
+  // either into vertex_storage and index_storage or into the mapped cache
+  // file
+  struct MeshData {
+    VertexLayout layout;
+    const void *vertices;
+    size_t vertex_count;
+    GLenum index_type;
+    const void *indices;
+    size_t index_count;
+    std::vector<Texture> textures; // type and path only, no ids yet
+    std::vector<MeshLod> lods;
+    Bounds bounds;
+    const aiMesh *morph_source; // blend shapes are built from the scene
+    std::vector<unsigned char> vertex_storage;
+    std::vector<unsigned char> index_storage;
+  };
+  std::vector<MeshData> mesh_data;
+  std::unique_ptr<MappedFile> mapping;
+  std::unique_ptr<Assimp::Importer> importer;
+
   void SetVertexBoneDataToDefault(Vertex &vertex) {
     for (int i = 0; i < MAX_BONE_WEIGHTS; i++) {
       vertex.boneIds[i] = -1;
@@ -98,10 +342,124 @@ private:
     };
   }
 
+  void readScene(const aiScene *scene) {
+    appendNodes(scene->mRootNode, -1);
+    processNode(scene->mRootNode, scene);
+  }
+
+  void appendNodes(const aiNode *node, int parent) {
+    int index = nodes.size();
+    nodes.push_back({node->mName.C_Str(),
+                     ConvertMatrixToGLMFormat(node->mTransformation), parent});
+    for (unsigned int i = 0; i < node->mNumChildren; i++)
+      appendNodes(node->mChildren[i], index);
+  }
+
+  // false, leaving the asset empty, if the cache file is missing or no
+  // longer matches: written by another cache_version or with other import
+  // options, or from a source file whose size or modification time has
+  // changed since
+  bool readCache() {
+    mapping = std::make_unique<MappedFile>();
+    if (!mapping->open(cache_path(file_path))) {
+      mapping.reset();
+      return false;
+    }
+    BinaryReader reader(mapping->data(), mapping->size());
+    SourceStamp stamp = SourceStamp::of(file_path);
+    bool matches = reader.read<uint32_t>() == cache_magic &&
+                   reader.read<uint32_t>() == cache_version &&
+                   reader.read<uint32_t>() == options.flags &&
+                   reader.read<uint32_t>() == (uint32_t)options.optimize_meshes &&
+                   reader.read<SourceStamp>() == stamp &&
+                   reader.read<uint32_t>() == options.lod_ratios.size();
+    for (size_t i = 0; matches && i < options.lod_ratios.size(); i++)
+      matches = reader.read<float>() == options.lod_ratios[i];
+    if (!matches || reader.read<float>() != options.lod_max_error) {
+      mapping.reset();
+      return false;
+    }
+
+    bone_counter = reader.read<int32_t>();
+    uint32_t bone_count = reader.read<uint32_t>();
+    for (uint32_t i = 0; i < bone_count && reader.ok(); i++) {
+      std::string name = reader.read_string();
+      BoneInfo info;
+      info.id = reader.read<int32_t>();
+      info.offset = reader.read<glm::mat4>();
+      bone_info_map[name] = info;
+    }
+    uint32_t bounds_count = reader.read<uint32_t>();
+    const AABB *bounds = reader.read_array<AABB>(bounds_count);
+    if (bounds)
+      bone_bounds.assign(bounds, bounds + bounds_count);
+    unskinned_bounds = reader.read<AABB>();
+
+    uint32_t node_count = reader.read<uint32_t>();
+    for (uint32_t i = 0; i < node_count && reader.ok(); i++) {
+      ModelNode node;
+      node.name = reader.read_string();
+      node.transformation = reader.read<glm::mat4>();
+      node.parent = reader.read<int32_t>();
+      nodes.push_back(node);
+    }
+
+    uint32_t mesh_count = reader.read<uint32_t>();
+    for (uint32_t m = 0; m < mesh_count && reader.ok(); m++) {
+      MeshData data;
+      uint32_t texture_count = reader.read<uint32_t>();
+      for (uint32_t t = 0; t < texture_count && reader.ok(); t++) {
+        Texture texture;
+        texture.id = 0;
+        texture.type = reader.read_string();
+        texture.path = reader.read_string();
+        data.textures.push_back(texture);
+      }
+      uint32_t layout = reader.read<uint32_t>();
+      if (layout > static_cast<uint32_t>(VertexLayout::skinned_wide))
+        reader.fail();
+      data.layout = static_cast<VertexLayout>(layout);
+      data.vertex_count = reader.read<uint32_t>();
+      data.vertices = reader.read_array<unsigned char>(
+          VertexFormat::of(data.layout).stride * data.vertex_count);
+      data.index_type = reader.read<uint32_t>();
+      if (data.index_type != GL_UNSIGNED_SHORT &&
+          data.index_type != GL_UNSIGNED_INT)
+        reader.fail();
+      data.index_count = reader.read<uint32_t>();
+      data.indices = reader.read_array<unsigned char>(
+          index_size(data.index_type) * data.index_count);
+      uint32_t lod_count = reader.read<uint32_t>();
+      const MeshLod *lods = reader.read_array<MeshLod>(lod_count);
+      if (lods)
+        data.lods.assign(lods, lods + lod_count);
+      for (const MeshLod &lod : data.lods)
+        if (lod.index_count % 3 != 0 || lod.first_index > data.index_count ||
+            lod.index_count > data.index_count - lod.first_index)
+          reader.fail();
+      data.bounds = reader.read<Bounds>();
+      data.morph_source = nullptr;
+      mesh_data.push_back(std::move(data));
+    }
+
+    // a truncated file is treated as missing and gets rewritten
+    if (!reader.ok()) {
+      bone_counter = 0;
+      bone_info_map.clear();
+      bone_bounds.clear();
+      unskinned_bounds = AABB();
+      nodes.clear();
+      mesh_data.clear();
+      mapping.reset();
+      return false;
+    }
+    return true;
+  }
+
   void processNode(aiNode *node, const aiScene *scene) {
     for (unsigned int i = 0; i < node->mNumMeshes; i++) {
       aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-      meshes.push_back(processMesh(mesh, scene));
+      mesh_data.push_back(processMesh(mesh, scene));
     }
 
     for (unsigned int i = 0; i < node->mNumChildren; i++) {
@@ -109,76 +467,36 @@ private:
     }
   }
 
-  unsigned int TextureFromFile(const char *path, const std::string &directory,
-                               bool gamma = false) {
-    std::string filename(path);
-    filename = directory + '/' + filename;
-
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    stbi_set_flip_vertically_on_load(false);
-    unsigned char *data =
-        stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data) {
-      GLenum format;
-      if (nrComponents == 1)
-        format = GL_RED;
-      else if (nrComponents == 3)
-        format = GL_RGB;
-      else if (nrComponents == 4)
-        format = GL_RGBA;
-
-      glBindTexture(GL_TEXTURE_2D, textureID);
-      glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
-                   GL_UNSIGNED_BYTE, data);
-      glGenerateMipmap(GL_TEXTURE_2D);
-
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                      GL_LINEAR_MIPMAP_LINEAR);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-      stbi_image_free(data);
-    } else {
-      stbi_image_free(data);
-      std::ostringstream error_message;
-      error_message << "Could not load texture at: " << filename << "\n";
-      throw std::logic_error(error_message.str());
-    }
-
-    return textureID;
-  }
-
+  // texture references only; the images are decoded by decode_images and
+  // uploaded by upload
   std::vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type,
                                             std::string typeName) {
     std::vector<Texture> textures;
     for (unsigned int i = 0; i < mat->GetTextureCount(type); i++) {
       aiString str;
       mat->GetTexture(type, i, &str);
-      bool skip = false;
-      for (unsigned int j = 0; j < textures_loaded.size(); j++) {
-        if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0) {
-          textures.push_back(textures_loaded[j]);
-          skip = true;
-          break;
-        }
-      }
-      if (!skip) { // if texture hasn't been loaded already, load it
-        Texture texture;
-        texture.id = TextureFromFile(str.C_Str(), dir);
-        texture.type = typeName;
-        texture.path = str.C_Str();
-        textures.push_back(texture);
-        textures_loaded.push_back(texture); // add to loaded textures
-      }
+      Texture texture;
+      texture.id = 0;
+      texture.type = typeName;
+      texture.path = str.C_Str();
+      textures.push_back(texture);
     }
     return textures;
   }
 
-  Mesh processMesh(aiMesh *mesh, const aiScene *scene) {
+  // the texture at path relative to dir, uploaded the first time any model
+  // uses it
+  Texture loadTexture(const std::string &path, const std::string &typeName) {
+    texture_handles.push_back(
+        TextureCache::shared().load(dir + '/' + path, texture_params));
+    Texture texture;
+    texture.id = texture_handles.back()->id();
+    texture.type = typeName;
+    texture.path = path;
+    return texture;
+  }
+
+  MeshData processMesh(aiMesh *mesh, const aiScene *scene) {
     // lots of copying here...
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indices;
@@ -234,8 +552,39 @@ private:
     }
 
     ExtractBoneWeightForVertices(vertices, mesh, scene);
-
-    return Mesh(vertices, indices, textures);
+    for (const Vertex &vertex : vertices)
+      if (vertex.boneIds[0] == -1)
+        unskinned_bounds.expand(vertex.position);
+
+    // blend shapes address vertices by their index in the source mesh
+    if (options.optimize_meshes)
+      optimization_reports.push_back(optimize_mesh(
+          mesh->mName.C_Str(), vertices, indices, mesh->mNumAnimMeshes == 0));
+
+    // levels only take triangles away, so they share the vertices and,
+    // blend shapes included, their order
+    std::vector<MeshLod> lods =
+        build_lod_chain(vertices.data(), vertices.size(), indices,
+                        options.lod_ratios, options.lod_max_error,
+                        options.optimize_meshes);
+
+    MeshData result;
+    result.layout =
+        choose_vertex_layout(max_bone_id(vertices.data(), vertices.size()));
+    result.index_type = choose_index_type(vertices.size());
+    result.vertex_storage =
+        pack_vertices(vertices.data(), vertices.size(), result.layout);
+    result.index_storage =
+        pack_indices(indices.data(), indices.size(), result.index_type);
+    result.vertices = result.vertex_storage.data();
+    result.vertex_count = vertices.size();
+    result.indices = result.index_storage.data();
+    result.index_count = indices.size();
+    result.textures = textures;
+    result.lods = lods;
+    result.bounds = Bounds::of(vertices.data(), vertices.size(), sizeof(Vertex));
+    result.morph_source = mesh->mNumAnimMeshes > 0 ? mesh : nullptr;
+    return result;
   }
 
   void SetVertexBoneData(Vertex &vertex, int boneID, float weight) {
@@ -248,7 +597,7 @@ private:
     }
   }
 
-  glm::mat4 ConvertMatrixToGLMFormat(const aiMatrix4x4 &from) {
+  static glm::mat4 ConvertMatrixToGLMFormat(const aiMatrix4x4 &from) {
     glm::mat4 to;
     to[0][0] = from.a1;
     to[1][0] = from.a2;
@@ -286,6 +635,8 @@ private:
         boneID = bone_info_map[boneName].id;
       }
       assert(boneID != -1);
+      if (bone_bounds.size() <= boneID)
+        bone_bounds.resize(boneID + 1);
       auto weights = mesh->mBones[boneIndex]->mWeights;
       int numWeights = mesh->mBones[boneIndex]->mNumWeights;
 
@@ -293,9 +644,334 @@ private:
         int vertexId = weights[weightIndex].mVertexId;
         float weight = weights[weightIndex].mWeight;
         SetVertexBoneData(vertices.at(vertexId), boneID, weight);
+        if (weight > 0.0f)
+          bone_bounds[boneID].expand(vertices[vertexId].position);
       }
     }
   }
 };
 
+// how one file was loaded by ModelCache
+struct ModelLoadReport {
+  std::string path;
+  bool from_cache; // binary cache hit rather than an Assimp import
+  float milliseconds;
+};
+
+/* imports each (path, import options) pair once. Later loads of the same file
+hand back the same asset for as long as any Model still uses it. Files are
+read from their binary cache when it is up to date; otherwise they are
+imported and the cache is (re)written for the next run. Only the GL thread
+calls into the cache */
+class ModelCache {
+public:
+  std::shared_ptr<ModelAsset>
+  load(const std::string &file_path,
+       const ImportOptions &options = ImportOptions()) {
+    std::string key = file_path + "#" + options.key();
+    std::shared_ptr<ModelAsset> asset = assets[key].lock();
+    if (!asset) {
+      auto start = std::chrono::steady_clock::now();
+      asset = std::make_shared<ModelAsset>(file_path, options);
+      bool from_cache = read(*asset);
+      asset->upload();
+      report(file_path, from_cache, start);
+      assets[key] = asset;
+    }
+    return asset;
+  }
+
+  /* like load, but reading and decoding run on one of loader's workers. The
+  asset comes back empty at once and has its meshes from the upload that
+  loader.update() or loader.finish() runs; Models can be made from it
+  before then */
+  std::shared_ptr<ModelAsset>
+  load_async(AssetLoader &loader, const std::string &file_path,
+             const ImportOptions &options = ImportOptions()) {
+    std::string key = file_path + "#" + options.key();
+    std::shared_ptr<ModelAsset> asset = assets[key].lock();
+    if (!asset) {
+      auto start = std::chrono::steady_clock::now();
+      asset = std::make_shared<ModelAsset>(file_path, options);
+      loader.load([this, asset, file_path, start] {
+        bool from_cache = read(*asset);
+        return [this, asset, file_path, from_cache, start] {
+          asset->upload();
+          report(file_path, from_cache, start);
+        };
+      });
+      assets[key] = asset;
+    }
+    return asset;
+  }
+
+  // one entry per file actually loaded, in load order
+  const std::vector<ModelLoadReport> &get_reports() const { return reports; }
+
+  // the cache Model's path constructor goes through
+  static ModelCache &shared() {
+    static ModelCache cache;
+    return cache;
+  }
+
+private:
+  std::map<std::string, std::weak_ptr<ModelAsset>> assets;
+  std::vector<ModelLoadReport> reports;
+
+  // the part of a load that needs no GL. Returns whether the cache was used
+  static bool read(ModelAsset &asset) {
+    bool from_cache = asset.read();
+    if (!from_cache)
+      asset.write_cache();
+    asset.decode_images();
+    return from_cache;
+  }
+
+  void report(const std::string &file_path, bool from_cache,
+              std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<float, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    reports.push_back({file_path, from_cache, elapsed.count()});
+  }
+};
+
+class Model {
+public:
+  // an instance of the file at file_path, imported only the first time
+  Model(Shader shader, const std::string &file_path)
+      : Model(shader, ModelCache::shared().load(file_path)) {}
+
+  // builds the model from a scene the caller already imported, so the same
+  // scene can also feed an AnimationLibrary
+  Model(Shader shader, const aiScene *scene, const std::string &file_path)
+      : Model(shader, std::make_shared<ModelAsset>(scene, file_path)) {}
+
+  Model(Shader shader, std::shared_ptr<ModelAsset> asset)
+      : shader(shader), asset(asset) {
+    lod_level = 0;
+    lod_pixel_error = 1.0f;
+    lod_hysteresis = 0.25f;
+    angle = 0;
+    scale = glm::vec3(1.0f);
+    position = glm::vec3(0.0f);
+    axis = glm::vec3(1.0f, 0, 0);
+  }
+
+  // draws the level of detail select_lod picks for camera
+  int draw(Camera &camera, bool shadow = false) {
+    glm::mat4 model = model_matrix();
+    int level = select_lod(camera);
+    if (shadow) {
+      shadow_shader.setMat4("model", model);
+      for (int i = 0; i < asset->meshes.size(); i++)
+          asset->meshes[i].draw(shadow_shader, level);
+    }
+    else {
+      shader.setMat4("projection", camera.projection());
+      shader.setMat4("view", camera.view());
+      shader.setMat4("model", model);
+
+      asset->touch_textures();
+      for (int i = 0; i < asset->meshes.size(); i++)
+          asset->meshes[i].draw(shader, level);
+    }
+    return 0;
+  }
+
+  /* the coarsest level of detail whose error (ModelAsset::lod_errors)
+  projects to at most lod_pixel_error pixels at the nearest point of the
+  bounding sphere. Moving to a
+  coarser level also needs it to be lod_hysteresis under that, so a model
+  right at a threshold doesn't switch back and forth every frame */
+  int select_lod(Camera &camera) {
+    const std::vector<float> &errors = asset->lod_errors;
+    if (errors.size() < 2)
+      return lod_level = 0;
+    const BoundingSphere &sphere = world_bounds().sphere;
+    float distance = std::max(
+        glm::length(camera.pos() - sphere.center) - sphere.radius, 0.001f);
+    float pixels_per_unit = std::max(scale.x, std::max(scale.y, scale.z)) *
+                            camera.pixel_scale() / distance;
+    lod_level = std::min<int>(lod_level, errors.size() - 1);
+    while (lod_level > 0 &&
+           errors[lod_level] * pixels_per_unit > lod_pixel_error)
+      lod_level--;
+    while (lod_level + 1 < (int)errors.size() &&
+           errors[lod_level + 1] * pixels_per_unit <=
+               lod_pixel_error * (1.0f - lod_hysteresis))
+      lod_level++;
+    return lod_level;
+  }
+
+  // the level the last draw used
+  int get_lod_level() const { return lod_level; }
+
+  void set_lod_threshold(float pixel_error, float hysteresis) {
+    lod_pixel_error = pixel_error;
+    lod_hysteresis = hysteresis;
+  }
+
+  // skins every mesh once into its own buffer; see Mesh::skin. The buffer
+  // belongs to the shared meshes, so only one instance of an asset can be
+  // pre-skinned at a time
+  void skin(Shader &skinning_shader) {
+    for (int i = 0; i < asset->meshes.size(); i++)
+      asset->meshes[i].skin(skinning_shader);
+  }
+
+  // draws the vertices from the last skin() with static_shader, which needs
+  // no bone data. In a shadow pass projection and view are left as they are
+  int draw_skinned(Shader &static_shader, Camera &camera, bool shadow = false) {
+    if (!shadow) {
+      static_shader.setMat4("projection", camera.projection());
+      static_shader.setMat4("view", camera.view());
+    }
+    static_shader.setMat4("model", model_matrix());
+    if (!shadow)
+      asset->touch_textures();
+    for (int i = 0; i < asset->meshes.size(); i++)
+      asset->meshes[i].draw_skinned(static_shader);
+    return 0;
+  }
+
+  // draws count copies of every mesh with instance_shader in one call per
+  // mesh. Per-instance data comes from set_instance_buffer.
+  int draw_instanced(Shader &instance_shader, Camera &camera, int count) {
+    instance_shader.setMat4("projection", camera.projection());
+    instance_shader.setMat4("view", camera.view());
+    asset->touch_textures();
+    for (int i = 0; i < asset->meshes.size(); i++)
+      asset->meshes[i].draw_instanced(instance_shader, count);
+    return asset->meshes.size();
+  }
+
+  void set_instance_buffer(unsigned int buffer, int first_location,
+                           const std::vector<int> &sizes, int stride) {
+    for (int i = 0; i < asset->meshes.size(); i++)
+      asset->meshes[i].set_instance_buffer(buffer, first_location, sizes, stride);
+  }
+
+  void set_pos(float x, float y, float z) { position = glm::vec3(x, y, z); }
+
+  void set_scale(float x, float y, float z) { scale = glm::vec3(x, y, z); }
+
+  void set_angle(float angle, glm::vec3 axis) {
+    this->angle = glm::radians(angle);
+    this->axis = axis;
+  }
+
+  Shader shader;
+  Shader shadow_shader;
+
+  std::map<std::string, BoneInfo> &get_bone_info_map() {
+    return asset->bone_info_map;
+  }
+  int bone_count() { return asset->bone_counter; }
+
+  // the imported data this instance draws, shared with every other instance
+  // of the same file
+  const std::shared_ptr<ModelAsset> &get_asset() const { return asset; }
+
+  // model space box around the mesh posed by palette (the final bone
+  // matrices, indexed by bone id). Costs one box transform per bone: each
+  // bone's bind space box is moved by its matrix, and every skinned vertex is
+  // a weighted mix of points inside those boxes
+  AABB skinned_bounds(const glm::mat4 *palette, int palette_size) const {
+    AABB box = asset->unskinned_bounds;
+    int bones = std::min<int>(palette_size, asset->bone_bounds.size());
+    for (int i = 0; i < bones; i++)
+      box.expand(asset->bone_bounds[i].transformed(palette[i]));
+    return box;
+  }
+
+  // model space bounds of all meshes, in bind pose for skinned ones. Empty
+  // until the asset is uploaded
+  const Bounds &bounds() const { return asset->bounds; }
+
+  // bounds() moved by the model matrix. Only recomputed when position,
+  // scale or angle changed since the last call
+  const Bounds &world_bounds() {
+    if (!world_bounds_valid || world_position != position ||
+        world_scale != scale || world_angle != angle || world_axis != axis) {
+      world = asset->bounds.transformed(model_matrix());
+      world_position = position;
+      world_scale = scale;
+      world_angle = angle;
+      world_axis = axis;
+      // an asset still loading gets its bounds later
+      world_bounds_valid = !asset->bounds.empty();
+    }
+    return world;
+  }
+
+  // skinned_bounds in world space
+  AABB world_skinned_bounds(const glm::mat4 *palette, int palette_size) {
+    return skinned_bounds(palette, palette_size).transformed(model_matrix());
+  }
+
+  // number of distinct blend shape names over all meshes
+  int morph_target_count() {
+    std::vector<std::string> names;
+    for (Mesh &mesh : asset->meshes) {
+      MorphTargets *targets = mesh.get_morph_targets();
+      for (int i = 0; targets && i < targets->size(); i++)
+        if (std::find(names.begin(), names.end(), targets->name(i)) ==
+            names.end())
+          names.push_back(targets->name(i));
+    }
+    return names.size();
+  }
+
+  // sets the weight of the blend shape called name on every mesh that has
+  // one. Returns false if none does
+  bool set_morph_weight(const std::string &name, float weight) {
+    bool found = false;
+    for (Mesh &mesh : asset->meshes) {
+      MorphTargets *targets = mesh.get_morph_targets();
+      int target = targets ? targets->find(name) : -1;
+      if (target != -1) {
+        targets->set_weight(target, weight);
+        found = true;
+      }
+    }
+    return found;
+  }
+
+  // accumulates the active blend shapes of every mesh, once per frame before
+  // any pass draws the model. Returns the number of vertex deltas applied
+  int update_morph_targets(Shader &accumulate_shader) {
+    int points = 0;
+    for (Mesh &mesh : asset->meshes)
+      if (MorphTargets *targets = mesh.get_morph_targets())
+        points += targets->accumulate(accumulate_shader);
+    return points;
+  }
+
+  glm::mat4 model_matrix() {
+    glm::mat4 model(1.0f);
+    model = glm::translate(model, position);
+    model = glm::scale(model, scale);
+    model = glm::rotate(model, angle, axis);
+    return model;
+  }
+
+  glm::vec3 position;
+private:
+  glm::vec3 scale;
+  float angle;
+  glm::vec3 axis;
+
+  // world_bounds() and the transform it was computed for
+  Bounds world;
+  bool world_bounds_valid = false;
+  glm::vec3 world_position, world_scale, world_axis;
+  float world_angle;
+
+  int lod_level;
+  float lod_pixel_error;
+  float lod_hysteresis; // fraction of lod_pixel_error
+
+  std::shared_ptr<ModelAsset> asset;
+};
+
 #endif
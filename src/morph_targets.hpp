@@ -0,0 +1,206 @@
+#ifndef MORPH_TARGETS_HPP
+#define MORPH_TARGETS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "../include/glad/glad.h"
+
+#include <assimp/scene.h>
+#include <glm/glm.hpp>
+
+#include "gl_object.hpp"
+#include "shader.hpp"
+
+/* blend shapes of one mesh, stored sparsely: each target keeps only the
+vertices it moves. All deltas live in one texture buffer, two texels per
+entry (position delta and vertex index, then normal delta). Every frame the
+targets with a non-zero weight are scattered as points into two float
+textures, one texel per vertex, which the vertex shaders add before
+skinning. The cost follows the number of moved vertices in active targets,
+not the number of targets */
+class MorphTargets {
+public:
+  // texels per row of the accumulated textures
+  static constexpr int row_width = 1024;
+  // deltas shorter than this are treated as unchanged and not stored
+  static constexpr float epsilon = 1e-6f;
+
+  MorphTargets(const aiMesh *mesh)
+      : vertex_count(mesh->mNumVertices), delta_buffer(0), delta_texture(0),
+        fbo(0), empty_vao(0) {
+    std::vector<glm::vec4> texels;
+    for (unsigned int t = 0; t < mesh->mNumAnimMeshes; t++) {
+      const aiAnimMesh *anim_mesh = mesh->mAnimMeshes[t];
+      Target target;
+      target.name = anim_mesh->mName.C_Str();
+      target.first = texels.size() / 2;
+      target.count = 0;
+
+      for (unsigned int v = 0; v < vertex_count; v++) {
+        glm::vec3 position_delta(0.0f);
+        glm::vec3 normal_delta(0.0f);
+        if (anim_mesh->mVertices)
+          position_delta = to_vec3(anim_mesh->mVertices[v]) -
+                           to_vec3(mesh->mVertices[v]);
+        if (anim_mesh->mNormals && mesh->mNormals)
+          normal_delta = to_vec3(anim_mesh->mNormals[v]) -
+                         to_vec3(mesh->mNormals[v]);
+        if (glm::dot(position_delta, position_delta) < epsilon * epsilon &&
+            glm::dot(normal_delta, normal_delta) < epsilon * epsilon)
+          continue;
+
+        // vertex indices stay exact as floats up to 2^24
+        texels.push_back(glm::vec4(position_delta, float(v)));
+        texels.push_back(glm::vec4(normal_delta, 0.0f));
+        target.count++;
+      }
+      targets.push_back(target);
+    }
+    weights.assign(targets.size(), 0.0f);
+
+    delta_buffer = GLBuffer::generate();
+    glBindBuffer(GL_TEXTURE_BUFFER, delta_buffer.id());
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4) * texels.size(),
+                 texels.data(), GL_STATIC_DRAW);
+    delta_texture = GLTexture::generate();
+    glBindTexture(GL_TEXTURE_BUFFER, delta_texture.id());
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, delta_buffer.id());
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    width = std::min<int>(row_width, std::max(1u, vertex_count));
+    height = (vertex_count + width - 1) / width;
+    fbo = GLFramebuffer::generate();
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo.id());
+    for (int i = 0; i < 2; i++) {
+      accumulated[i] = GLTexture::generate();
+      glBindTexture(GL_TEXTURE_2D, accumulated[i].id());
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA,
+                   GL_FLOAT, NULL);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i,
+                             GL_TEXTURE_2D, accumulated[i].id(), 0);
+    }
+    GLenum draw_buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, draw_buffers);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // points are generated from gl_VertexID alone, but core profile still
+    // wants a vertex array bound
+    empty_vao = GLVertexArray::generate();
+  }
+
+  int size() const { return targets.size(); }
+
+  const std::string &name(int target) const { return targets[target].name; }
+
+  // -1 if no target is called name
+  int find(const std::string &name) const {
+    for (size_t i = 0; i < targets.size(); i++)
+      if (targets[i].name == name)
+        return i;
+    return -1;
+  }
+
+  void set_weight(int target, float weight) { weights[target] = weight; }
+
+  float weight(int target) const { return weights[target]; }
+
+  // number of moved vertices stored for target
+  int delta_count(int target) const { return targets[target].count; }
+
+  /* sums weight * delta of every active target into the accumulated
+  textures. accumulate_shader is morph_accumulate_vertex.glsl with
+  morph_accumulate_fragment.glsl. Returns the number of points drawn */
+  int accumulate(Shader &accumulate_shader) {
+    GLint previous_fbo, viewport[4], blend_src, blend_dst;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous_fbo);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_BLEND_SRC_RGB, &blend_src);
+    glGetIntegerv(GL_BLEND_DST_RGB, &blend_dst);
+    GLboolean blend = glIsEnabled(GL_BLEND);
+    GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+    GLfloat clear_color[4];
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo.id());
+    glViewport(0, 0, width, height);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, delta_texture.id());
+    accumulate_shader.setInt("deltas", 0);
+    accumulate_shader.setInt("width", width);
+    accumulate_shader.setVec2("targetSize", glm::vec2(width, height));
+    glBindVertexArray(empty_vao.id());
+
+    int points = 0;
+    for (size_t i = 0; i < targets.size(); i++) {
+      if (weights[i] == 0.0f || targets[i].count == 0)
+        continue;
+      accumulate_shader.setInt("firstDelta", targets[i].first);
+      accumulate_shader.setFloat("weight", weights[i]);
+      glDrawArrays(GL_POINTS, 0, targets[i].count);
+      points += targets[i].count;
+    }
+
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBlendFunc(blend_src, blend_dst);
+    glClearColor(clear_color[0], clear_color[1], clear_color[2],
+                 clear_color[3]);
+    if (!blend)
+      glDisable(GL_BLEND);
+    if (depth_test)
+      glEnable(GL_DEPTH_TEST);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glBindFramebuffer(GL_FRAMEBUFFER, previous_fbo);
+    return points;
+  }
+
+  // binds the accumulated deltas to first_unit and first_unit + 1
+  void bind(Shader &shader, int first_unit) {
+    glActiveTexture(GL_TEXTURE0 + first_unit);
+    glBindTexture(GL_TEXTURE_2D, accumulated[0].id());
+    glActiveTexture(GL_TEXTURE0 + first_unit + 1);
+    glBindTexture(GL_TEXTURE_2D, accumulated[1].id());
+    shader.setInt("morphPositions", first_unit);
+    shader.setInt("morphNormals", first_unit + 1);
+    shader.setInt("hasMorphTargets", 1);
+  }
+
+  static void unbind(Shader &shader) { shader.setInt("hasMorphTargets", 0); }
+
+private:
+  struct Target {
+    std::string name;
+    int first; // entry in the delta buffer
+    int count;
+  };
+
+  unsigned int vertex_count;
+  std::vector<Target> targets;
+  std::vector<float> weights;
+  int width, height;
+
+  GLBuffer delta_buffer;
+  GLTexture delta_texture;
+  GLFramebuffer fbo;
+  GLTexture accumulated[2]; // position and normal deltas per vertex
+  GLVertexArray empty_vao;
+
+  static glm::vec3 to_vec3(const aiVector3D &v) {
+    return glm::vec3(v.x, v.y, v.z);
+  }
+};
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef POSE_HPP
+#define POSE_HPP
+
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define POSE_SSE 1
+#endif
+
+/* local translation, rotation and scale of every skeleton node, kept as one
+stream per component so poses can be sampled and blended four nodes at a
+time. Streams are padded to a multiple of four with identity transforms */
+struct LocalPose {
+  std::vector<float> tx, ty, tz;
+  std::vector<float> rx, ry, rz, rw;
+  std::vector<float> sx, sy, sz;
+  int count = 0;
+
+  void resize(int nodes) {
+    count = nodes;
+    int padded = (nodes + 3) & ~3;
+    for (std::vector<float> *stream : {&tx, &ty, &tz, &rx, &ry, &rz})
+      stream->resize(padded, 0.0f);
+    for (std::vector<float> *stream : {&rw, &sx, &sy, &sz})
+      stream->resize(padded, 1.0f);
+  }
+
+  int padded() const { return tx.size(); }
+
+  void set(int i, const glm::vec3 &t, const glm::quat &r, const glm::vec3 &s) {
+    tx[i] = t.x;
+    ty[i] = t.y;
+    tz[i] = t.z;
+    rx[i] = r.x;
+    ry[i] = r.y;
+    rz[i] = r.z;
+    rw[i] = r.w;
+    sx[i] = s.x;
+    sy[i] = s.y;
+    sz[i] = s.z;
+  }
+
+  /* translate * rotate * scale, built directly rather than by multiplying
+  three matrices */
+  glm::mat4 matrix(int i) const {
+    float x = rx[i], y = ry[i], z = rz[i], w = rw[i];
+    glm::mat4 m(1.0f);
+    m[0] = glm::vec4(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z),
+                     2.0f * (x * z - w * y), 0.0f) * sx[i];
+    m[1] = glm::vec4(2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z),
+                     2.0f * (y * z + w * x), 0.0f) * sy[i];
+    m[2] = glm::vec4(2.0f * (x * z + w * y), 2.0f * (y * z - w * x),
+                     1.0f - 2.0f * (x * x + y * y), 0.0f) * sz[i];
+    m[3] = glm::vec4(tx[i], ty[i], tz[i], 1.0f);
+    return m;
+  }
+};
+
+/* out = mix(a, b) per node: translations and scales are lerped, rotations
+nlerped along the shortest arc. Each channel has its own weight stream, so
+this does both key interpolation and pose blending. out may alias a or b */
+inline void MixPoses(const LocalPose &a, const LocalPose &b,
+                     const float *translationWeights,
+                     const float *rotationWeights, const float *scaleWeights,
+                     LocalPose &out) {
+  out.resize(a.count);
+  int n = a.padded();
+#ifdef POSE_SSE
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  auto lerp = [](__m128 x, __m128 y, __m128 t) {
+    return _mm_add_ps(x, _mm_mul_ps(_mm_sub_ps(y, x), t));
+  };
+  for (int i = 0; i < n; i += 4) {
+    __m128 wt = _mm_loadu_ps(translationWeights + i);
+    _mm_storeu_ps(&out.tx[i], lerp(_mm_loadu_ps(&a.tx[i]),
+                                   _mm_loadu_ps(&b.tx[i]), wt));
+    _mm_storeu_ps(&out.ty[i], lerp(_mm_loadu_ps(&a.ty[i]),
+                                   _mm_loadu_ps(&b.ty[i]), wt));
+    _mm_storeu_ps(&out.tz[i], lerp(_mm_loadu_ps(&a.tz[i]),
+                                   _mm_loadu_ps(&b.tz[i]), wt));
+
+    __m128 ws = _mm_loadu_ps(scaleWeights + i);
+    _mm_storeu_ps(&out.sx[i], lerp(_mm_loadu_ps(&a.sx[i]),
+                                   _mm_loadu_ps(&b.sx[i]), ws));
+    _mm_storeu_ps(&out.sy[i], lerp(_mm_loadu_ps(&a.sy[i]),
+                                   _mm_loadu_ps(&b.sy[i]), ws));
+    _mm_storeu_ps(&out.sz[i], lerp(_mm_loadu_ps(&a.sz[i]),
+                                   _mm_loadu_ps(&b.sz[i]), ws));
+
+    __m128 ax = _mm_loadu_ps(&a.rx[i]), ay = _mm_loadu_ps(&a.ry[i]);
+    __m128 az = _mm_loadu_ps(&a.rz[i]), aw = _mm_loadu_ps(&a.rw[i]);
+    __m128 bx = _mm_loadu_ps(&b.rx[i]), by = _mm_loadu_ps(&b.ry[i]);
+    __m128 bz = _mm_loadu_ps(&b.rz[i]), bw = _mm_loadu_ps(&b.rw[i]);
+
+    // flip b where it lies in the other hemisphere
+    __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+                            _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+    __m128 flip = _mm_and_ps(dot, sign);
+    bx = _mm_xor_ps(bx, flip);
+    by = _mm_xor_ps(by, flip);
+    bz = _mm_xor_ps(bz, flip);
+    bw = _mm_xor_ps(bw, flip);
+
+    __m128 wr = _mm_loadu_ps(rotationWeights + i);
+    __m128 x = lerp(ax, bx, wr), y = lerp(ay, by, wr);
+    __m128 z = lerp(az, bz, wr), w = lerp(aw, bw, wr);
+    __m128 length = _mm_sqrt_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+                   _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w))));
+    __m128 inverse = _mm_div_ps(one, length);
+    _mm_storeu_ps(&out.rx[i], _mm_mul_ps(x, inverse));
+    _mm_storeu_ps(&out.ry[i], _mm_mul_ps(y, inverse));
+    _mm_storeu_ps(&out.rz[i], _mm_mul_ps(z, inverse));
+    _mm_storeu_ps(&out.rw[i], _mm_mul_ps(w, inverse));
+  }
+#else
+  for (int i = 0; i < n; i++) {
+    float wt = translationWeights[i];
+    out.tx[i] = a.tx[i] + (b.tx[i] - a.tx[i]) * wt;
+    out.ty[i] = a.ty[i] + (b.ty[i] - a.ty[i]) * wt;
+    out.tz[i] = a.tz[i] + (b.tz[i] - a.tz[i]) * wt;
+
+    float ws = scaleWeights[i];
+    out.sx[i] = a.sx[i] + (b.sx[i] - a.sx[i]) * ws;
+    out.sy[i] = a.sy[i] + (b.sy[i] - a.sy[i]) * ws;
+    out.sz[i] = a.sz[i] + (b.sz[i] - a.sz[i]) * ws;
+
+    float dot = a.rx[i] * b.rx[i] + a.ry[i] * b.ry[i] + a.rz[i] * b.rz[i] +
+                a.rw[i] * b.rw[i];
+    float flip = dot < 0.0f ? -1.0f : 1.0f;
+    float wr = rotationWeights[i];
+    float x = a.rx[i] + (b.rx[i] * flip - a.rx[i]) * wr;
+    float y = a.ry[i] + (b.ry[i] * flip - a.ry[i]) * wr;
+    float z = a.rz[i] + (b.rz[i] * flip - a.rz[i]) * wr;
+    float w = a.rw[i] + (b.rw[i] * flip - a.rw[i]) * wr;
+    float inverse = 1.0f / std::sqrt(x * x + y * y + z * z + w * w);
+    out.rx[i] = x * inverse;
+    out.ry[i] = y * inverse;
+    out.rz[i] = z * inverse;
+    out.rw[i] = w * inverse;
+  }
+#endif
+}
+
+/* out = mix(a, b, weight) for every node and channel */
+inline void BlendPoses(const LocalPose &a, const LocalPose &b, float weight,
+                       LocalPose &out) {
+  thread_local std::vector<float> weights;
+  weights.assign(a.padded(), weight);
+  MixPoses(a, b, weights.data(), weights.data(), weights.data(), out);
+}
+
+#endif
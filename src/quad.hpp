@@ -1,30 +1,21 @@
 #ifndef QUAD_HPP
 #define QUAD_HPP
 
+#include <memory>
 #include <vector>
 #include "field.hpp"
+#include "gl_object.hpp"
 #include "shader.hpp"
 #include "camera.hpp"
 #include "helpers.hpp"
+#include "texture_cache.hpp"
 
+/* a flat square in the xz plane. Like Box, every Quad draws the same vertex
+buffer; Quads showing the same picture share the texture through the
+TextureCache */
 class Quad {
 public:
-  Quad (Shader shader) : shader(shader) {
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glBindVertexArray(0);
-
+  Quad (Shader shader) : shader(shader), geometry(shared_geometry()) {
     scale_vec = glm::vec3(1, 1, 1);
     position_vec = glm::vec3(0, 0, 0);
     color_vec = glm::vec3(1, 1, 1);
@@ -36,26 +27,9 @@ public:
   }
 
   void setTexture(std::string path) {
-    glBindVertexArray(vao);
     use_texture = true;
-    int width, height, channels;
-    unsigned char* image = load_image(path, &width, &height, &channels, true);
-
-    glGenTextures(1, &texture_id);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // how to resample down
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // how to resample up
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    stbi_image_free(image);
+    texture = TextureCache::shared().load(path, texture_params());
     shader.setInt("inputTexture", 0);
-    glBindVertexArray(0);
   }
 
   void position(float x, float y, float z) {
@@ -82,7 +56,7 @@ public:
 
   void draw(Camera& camera) {
     shader.bind();
-    glBindVertexArray(vao);
+    glBindVertexArray(geometry->vao.id());
 
     if (camera.projection() != cameraProjection) {
       cameraProjection = camera.projection();
@@ -92,7 +66,8 @@ public:
 
     if (use_texture) {
       glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, texture_id);
+      glBindTexture(GL_TEXTURE_2D, texture->id());
+      TextureCache::shared().touch(texture);
     } else {
       shader.setVec3("color", color_vec);
     }
@@ -107,22 +82,12 @@ public:
 
   Shader shader;
 private:
-  unsigned int vao;
-  unsigned int vbo;
-  
-  unsigned int texture_id;
-  bool use_texture;
-
-  glm::mat4 cameraProjection;
+  struct Geometry {
+    GLVertexArray vao;
+    GLBuffer vbo;
 
-  glm::vec3 scale_vec;
-  glm::vec3 position_vec;
-  glm::vec3 color_vec;
-
-  glm::vec3 rotation_axis;
-  float radians;
-
-  std::vector<float> vertices = {
+    Geometry() : vao(GLVertexArray::generate()), vbo(GLBuffer::generate()) {
+      static const float vertices[] = {
         // positions          // normals           // texture coords
         -1.0f, 0.0f, -1.0f,  0.0f,  1.0f, 0.0f,  0.0f,  0.0f,
          1.0f, 0.0f, -1.0f,  0.0f,  1.0f, 0.0f,  1.0f,  0.0f,
@@ -131,8 +96,56 @@ private:
          1.0f,  0.0f, 1.0f,  0.0f,  1.0f, 0.0f,  1.0f,  1.0f,
         -1.0f,  0.0f, 1.0f,  0.0f,  1.0f, 0.0f,  0.0f,  1.0f,
         -1.0f, 0.0f, -1.0f,  0.0f,  1.0f, 0.0f,  0.0f,  0.0f,
+      };
+
+      glBindVertexArray(vao.id());
+      glBindBuffer(GL_ARRAY_BUFFER, vbo.id());
+      glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+
+      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+      glEnableVertexAttribArray(0);
+      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+      glEnableVertexAttribArray(1);
+      glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+      glEnableVertexAttribArray(2);
+      glBindVertexArray(0);
+    }
   };
 
+  // made by the first Quad alive and deleted with the last
+  static std::shared_ptr<Geometry> shared_geometry() {
+    static std::weak_ptr<Geometry> current;
+    std::shared_ptr<Geometry> geometry = current.lock();
+    if (!geometry) {
+      geometry = std::make_shared<Geometry>();
+      current = geometry;
+    }
+    return geometry;
+  }
+
+  std::shared_ptr<Geometry> geometry;
+
+  // the same as Grass's, so a picture used by both is loaded once
+  static TextureParams texture_params() {
+    TextureParams params;
+    params.wrap = GL_CLAMP_TO_EDGE;
+    params.min_filter = GL_LINEAR; // how to resample down
+    params.mag_filter = GL_LINEAR; // how to resample up
+    params.flip = true;
+    return params;
+  }
+  
+  TextureCache::Handle texture;
+  bool use_texture;
+
+  glm::mat4 cameraProjection;
+
+  glm::vec3 scale_vec;
+  glm::vec3 position_vec;
+  glm::vec3 color_vec;
+
+  glm::vec3 rotation_axis;
+  float radians;
 };
 
 #endif
@@ -7,44 +7,53 @@
 #include <ostream>
 #include <sstream>
 #include <cstring>
+#include <memory>
+#include <vector>
 
 #include "../include/glad/glad.h"
 
+#include "gl_object.hpp"
+
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+/* a linked program. Copies share it, and the program is deleted along with
+the last copy. A default constructed Shader has no program until one is
+assigned to it */
 class Shader {
 public:
   Shader() {}
 
   Shader(const std::string& vertex_shader_file_path,
          const std::string& fragment_shader_file_path) {
-    unsigned int vertex_shader = compile(vertex_shader_file_path, GL_VERTEX_SHADER);
-    unsigned int fragment_shader = compile(fragment_shader_file_path, GL_FRAGMENT_SHADER);
-
-    program_id = glCreateProgram();
-    glAttachShader(program_id, vertex_shader);
-    glAttachShader(program_id, fragment_shader);
-    glLinkProgram(program_id);
+    GLShader vertex_shader = compile(vertex_shader_file_path, GL_VERTEX_SHADER);
+    GLShader fragment_shader = compile(fragment_shader_file_path, GL_FRAGMENT_SHADER);
 
-    // Link shaders
-    int shader_link_success;
-    char link_log[512];
-    glGetProgramiv(program_id, GL_LINK_STATUS, &shader_link_success);
-    if (!shader_link_success) {
-      glGetProgramInfoLog(program_id, 512, NULL, link_log);
-      std::ostringstream error_message;
-      error_message << link_log;
-      throw std::logic_error(error_message.str());
-    }
+    program = std::make_shared<GLProgram>(GLProgram::generate());
+    glAttachShader(program_id(), vertex_shader.id());
+    glAttachShader(program_id(), fragment_shader.id());
+    link();
+  }
 
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
+  // vertex-only program whose outputs named in feedback_varyings are captured
+  // interleaved by transform feedback; draw with GL_RASTERIZER_DISCARD
+  Shader(const std::string& vertex_shader_file_path,
+         const std::vector<std::string>& feedback_varyings) {
+    GLShader vertex_shader = compile(vertex_shader_file_path, GL_VERTEX_SHADER);
+
+    program = std::make_shared<GLProgram>(GLProgram::generate());
+    glAttachShader(program_id(), vertex_shader.id());
+    std::vector<const char*> varyings;
+    for (const std::string& varying : feedback_varyings)
+      varyings.push_back(varying.c_str());
+    glTransformFeedbackVaryings(program_id(), varyings.size(), varyings.data(),
+                                GL_INTERLEAVED_ATTRIBS);
+    link();
   }
 
   void bind() {
-    glUseProgram(program_id);
+    glUseProgram(program_id());
   }
 
   void unbind() {
@@ -53,46 +62,70 @@ public:
 
   void setFloat(const std::string& uniform_name, float value) {
     bind();
-    int location = glGetUniformLocation(program_id, uniform_name.c_str());
+    int location = glGetUniformLocation(program_id(), uniform_name.c_str());
     glUniform1f(location, value);
   }
 
   void setInt(const std::string& uniform_name, int value) {
     bind();
-    int location = glGetUniformLocation(program_id, uniform_name.c_str());
+    int location = glGetUniformLocation(program_id(), uniform_name.c_str());
     glUniform1i(location, value);
   }
 
   void setVec3(const std::string& uniform_name, glm::vec3 vec) {
     bind();
-    int location = glGetUniformLocation(program_id, uniform_name.c_str());
+    int location = glGetUniformLocation(program_id(), uniform_name.c_str());
     glUniform3f(location, vec.x, vec.y, vec.z);
   }
 
   void setVec2(const std::string& uniform_name, glm::vec2 vec) {
     bind();
-    int location = glGetUniformLocation(program_id, uniform_name.c_str());
+    int location = glGetUniformLocation(program_id(), uniform_name.c_str());
     glUniform2f(location, vec.x, vec.y);
   }
 
+  // count elements of a vec2 array uniform, from its first on
+  void setVec2Array(const std::string& uniform_name, const glm::vec2* values,
+                    int count) {
+    bind();
+    int location = glGetUniformLocation(program_id(), uniform_name.c_str());
+    glUniform2fv(location, count, &values[0].x);
+  }
+
   void setMat4(const std::string& uniform_name, glm::mat4 value) {
     bind();
-    int location = glGetUniformLocation(program_id, uniform_name.c_str());
+    int location = glGetUniformLocation(program_id(), uniform_name.c_str());
     glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
   }
 
 private:
-  unsigned int program_id;
+  std::shared_ptr<GLProgram> program;
+
+  unsigned int program_id() const { return program ? program->id() : 0; }
+
+  // the shaders can be deleted once linked; the program keeps what it needs
+  void link() {
+    glLinkProgram(program_id());
+
+    // Link shaders
+    int shader_link_success;
+    char link_log[512];
+    glGetProgramiv(program_id(), GL_LINK_STATUS, &shader_link_success);
+    if (!shader_link_success) {
+      glGetProgramInfoLog(program_id(), 512, NULL, link_log);
+      std::ostringstream error_message;
+      error_message << link_log;
+      throw std::logic_error(error_message.str());
+    }
+  }
 
-  unsigned int compile(const std::string& shader_file_path, unsigned int shader_type) {
-    char* shader_source;
+  GLShader compile(const std::string& shader_file_path, unsigned int shader_type) {
+    std::string str;
     std::ifstream shader_stream(shader_file_path, std::ios::in);
     if (shader_stream.is_open()) {
       std::stringstream shader_source_stream;
       shader_source_stream << shader_stream.rdbuf();
-      std::string str = shader_source_stream.str();
-      shader_source = new char[str.size() + 1];
-      std::strcpy(shader_source, str.c_str());
+      str = shader_source_stream.str();
       shader_stream.close();
     } else {
       std::stringstream error_message;
@@ -100,16 +133,16 @@ private:
       throw std::logic_error(error_message.str());
     }
 
-    unsigned int shader;
-    shader = glCreateShader(shader_type);
-    glShaderSource(shader, 1, &shader_source, NULL);
-    glCompileShader(shader);
+    GLShader shader(glCreateShader(shader_type));
+    const char* shader_source = str.c_str();
+    glShaderSource(shader.id(), 1, &shader_source, NULL);
+    glCompileShader(shader.id());
 
     int shader_compilation_success;
     char compilation_log[512];
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &shader_compilation_success);
+    glGetShaderiv(shader.id(), GL_COMPILE_STATUS, &shader_compilation_success);
     if (!shader_compilation_success) {
-      glGetShaderInfoLog(shader, 512, NULL, compilation_log);
+      glGetShaderInfoLog(shader.id(), 512, NULL, compilation_log);
       std::ostringstream error_message;
       error_message << compilation_log << "\n"
                     << shader_file_path << "\n";
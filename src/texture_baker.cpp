@@ -0,0 +1,548 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "binary_cache.hpp"
+#include "texture_baker.hpp"
+
+namespace {
+
+// bump whenever the layout of the baked file or the encoders change
+const uint32_t baked_version = 3;
+const uint32_t baked_magic = 0x42584554; // "TEXB"
+
+// the columns (or rows) of a level that texel i of the next level down
+// averages: two, or three for the last one of an odd size, so the odd column
+// isn't dropped. A size of 1 stays as it is
+void source_range(int i, int size, int next_size, int *first, int *last) {
+  if (size == 1) {
+    *first = *last = 0;
+    return;
+  }
+  *first = 2 * i;
+  *last = i == next_size - 1 ? size - 1 : 2 * i + 1;
+}
+
+// the next level down: half the size (rounded down), each texel the average
+// of the 2x2 texels above it. At odd edges the last texels take in the
+// leftover row or column too, averaging 2x3, 3x2 or 3x3
+std::vector<unsigned char> downsample(const unsigned char *pixels, int width,
+                                      int height, int channels) {
+  int next_width = std::max(1, width / 2);
+  int next_height = std::max(1, height / 2);
+  std::vector<unsigned char> next(size_t(next_width) * next_height * channels);
+  for (int y = 0; y < next_height; y++) {
+    int y0, y1;
+    source_range(y, height, next_height, &y0, &y1);
+    for (int x = 0; x < next_width; x++) {
+      int x0, x1;
+      source_range(x, width, next_width, &x0, &x1);
+      int count = (y1 - y0 + 1) * (x1 - x0 + 1);
+      for (int c = 0; c < channels; c++) {
+        int sum = 0;
+        for (int sy = y0; sy <= y1; sy++)
+          for (int sx = x0; sx <= x1; sx++)
+            sum += pixels[(size_t(sy) * width + sx) * channels + c];
+        next[(size_t(y) * next_width + x) * channels + c] =
+            (sum + count / 2) / count;
+      }
+    }
+  }
+  return next;
+}
+
+// the 4x4 block at (block_x, block_y) as RGBA, clamped at the edges so
+// levels smaller than a block repeat their last texels
+void fetch_block(const unsigned char *pixels, int width, int height,
+                 int channels, int block_x, int block_y,
+                 unsigned char block[16][4]) {
+  for (int i = 0; i < 16; i++) {
+    int x = std::min(block_x * 4 + i % 4, width - 1);
+    int y = std::min(block_y * 4 + i / 4, height - 1);
+    const unsigned char *texel = pixels + (size_t(y) * width + x) * channels;
+    block[i][0] = texel[0];
+    block[i][1] = channels > 1 ? texel[1] : 0;
+    block[i][2] = channels > 2 ? texel[2] : 0;
+    block[i][3] = channels > 3 ? texel[3] : 255;
+  }
+}
+
+uint16_t pack565(const float color[3]) {
+  int r = std::clamp(int(color[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+  int g = std::clamp(int(color[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+  int b = std::clamp(int(color[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+  return uint16_t(r << 11 | g << 5 | b);
+}
+
+void unpack565(uint16_t packed, int color[3]) {
+  int r = packed >> 11 & 31, g = packed >> 5 & 63, b = packed & 31;
+  color[0] = r << 3 | r >> 2;
+  color[1] = g << 2 | g >> 4;
+  color[2] = b << 3 | b >> 2;
+}
+
+void put16(unsigned char *out, uint16_t value) {
+  out[0] = value & 0xff;
+  out[1] = value >> 8;
+}
+
+/* BC1 color block, always in four color mode so it also serves BC3. The
+endpoints are the extremes of the block along its principal axis, pulled in
+by a sixteenth of the range since the extremes themselves rarely need to be
+hit exactly */
+void encode_color_block(const unsigned char block[16][4], unsigned char *out) {
+  float mean[3] = {};
+  for (int i = 0; i < 16; i++)
+    for (int c = 0; c < 3; c++)
+      mean[c] += block[i][c] / 16.0f;
+
+  float covariance[6] = {}; // rr rg rb gg gb bb
+  for (int i = 0; i < 16; i++) {
+    float r = block[i][0] - mean[0], g = block[i][1] - mean[1],
+          b = block[i][2] - mean[2];
+    covariance[0] += r * r;
+    covariance[1] += r * g;
+    covariance[2] += r * b;
+    covariance[3] += g * g;
+    covariance[4] += g * b;
+    covariance[5] += b * b;
+  }
+
+  // power iteration for the covariance's largest eigenvector
+  float axis[3] = {1.0f, 1.0f, 1.0f};
+  for (int iteration = 0; iteration < 8; iteration++) {
+    float next[3] = {
+        covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+        covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+        covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]};
+    float length = std::max({std::fabs(next[0]), std::fabs(next[1]),
+                             std::fabs(next[2])});
+    if (length == 0.0f)
+      break;
+    for (int c = 0; c < 3; c++)
+      axis[c] = next[c] / length;
+  }
+
+  float low = 0.0f, high = 0.0f;
+  float axis_length2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+  for (int i = 0; i < 16; i++) {
+    float t = 0.0f;
+    for (int c = 0; c < 3; c++)
+      t += (block[i][c] - mean[c]) * axis[c];
+    t /= axis_length2;
+    low = std::min(low, t);
+    high = std::max(high, t);
+  }
+  float inset = (high - low) / 16.0f;
+  low += inset;
+  high -= inset;
+
+  float max_color[3], min_color[3];
+  for (int c = 0; c < 3; c++) {
+    max_color[c] = mean[c] + axis[c] * high;
+    min_color[c] = mean[c] + axis[c] * low;
+  }
+  uint16_t color0 = pack565(max_color);
+  uint16_t color1 = pack565(min_color);
+  if (color0 < color1)
+    std::swap(color0, color1);
+
+  put16(out, color0);
+  put16(out + 2, color1);
+  uint32_t indices = 0;
+  if (color0 != color1) {
+    int palette[4][3];
+    unpack565(color0, palette[0]);
+    unpack565(color1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    for (int i = 0; i < 16; i++) {
+      int best = 0, best_distance = INT32_MAX;
+      for (int p = 0; p < 4; p++) {
+        int distance = 0;
+        for (int c = 0; c < 3; c++) {
+          int d = block[i][c] - palette[p][c];
+          distance += d * d;
+        }
+        if (distance < best_distance) {
+          best = p;
+          best_distance = distance;
+        }
+      }
+      indices |= uint32_t(best) << (2 * i);
+    }
+  }
+  for (int b = 0; b < 4; b++)
+    out[4 + b] = indices >> (8 * b) & 0xff;
+}
+
+// BC4 block of one channel, in eight value mode between its extremes. Also
+// the alpha half of BC3 and each half of BC5
+void encode_channel_block(const unsigned char block[16][4], int channel,
+                          unsigned char *out) {
+  int low = 255, high = 0;
+  for (int i = 0; i < 16; i++) {
+    low = std::min<int>(low, block[i][channel]);
+    high = std::max<int>(high, block[i][channel]);
+  }
+  out[0] = high;
+  out[1] = low;
+
+  uint64_t indices = 0;
+  if (high != low) {
+    int palette[8];
+    palette[0] = high;
+    palette[1] = low;
+    for (int p = 2; p < 8; p++)
+      palette[p] = ((8 - p) * high + (p - 1) * low) / 7;
+    for (int i = 0; i < 16; i++) {
+      int best = 0, best_distance = 256;
+      for (int p = 0; p < 8; p++) {
+        int distance = std::abs(block[i][channel] - palette[p]);
+        if (distance < best_distance) {
+          best = p;
+          best_distance = distance;
+        }
+      }
+      indices |= uint64_t(best) << (3 * i);
+    }
+  }
+  for (int b = 0; b < 6; b++)
+    out[2 + b] = indices >> (8 * b) & 0xff;
+}
+
+size_t block_bytes(GLenum internal_format) {
+  return internal_format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ||
+                 internal_format == GL_COMPRESSED_RED_RGTC1
+             ? 8
+             : 16;
+}
+
+std::vector<unsigned char> compress_level(const unsigned char *pixels,
+                                          int width, int height, int channels,
+                                          GLenum internal_format) {
+  int blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+  size_t bytes = block_bytes(internal_format);
+  std::vector<unsigned char> blocks(size_t(blocks_x) * blocks_y * bytes);
+  unsigned char block[16][4];
+  unsigned char *out = blocks.data();
+  for (int y = 0; y < blocks_y; y++)
+    for (int x = 0; x < blocks_x; x++, out += bytes) {
+      fetch_block(pixels, width, height, channels, x, y, block);
+      switch (internal_format) {
+      case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        encode_color_block(block, out);
+        break;
+      case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        encode_channel_block(block, 3, out);
+        encode_color_block(block, out + 8);
+        break;
+      case GL_COMPRESSED_RED_RGTC1:
+        encode_channel_block(block, 0, out);
+        break;
+      case GL_COMPRESSED_RG_RGTC2:
+        encode_channel_block(block, 0, out);
+        encode_channel_block(block, 1, out + 8);
+        break;
+      }
+    }
+  return blocks;
+}
+
+bool opaque(const Image &image) {
+  if (image.channels < 4)
+    return true;
+  size_t texels = size_t(image.width) * image.height;
+  for (size_t i = 0; i < texels; i++)
+    if (image.pixels.get()[i * 4 + 3] != 255)
+      return false;
+  return true;
+}
+
+// image with an opaque alpha channel added, and any missing green and blue
+// zero, as GL expands them when sampling
+Image expand_to_rgba(const Image &image) {
+  Image expanded;
+  expanded.width = image.width;
+  expanded.height = image.height;
+  expanded.channels = 4;
+  size_t texels = size_t(image.width) * image.height;
+  expanded.pixels.reset(new unsigned char[texels * 4],
+                        std::default_delete<unsigned char[]>());
+  for (size_t i = 0; i < texels; i++)
+    for (int c = 0; c < 4; c++)
+      expanded.pixels.get()[i * 4 + c] =
+          c < image.channels ? image.pixels.get()[i * image.channels + c]
+                             : c == 3 ? 255 : 0;
+  return expanded;
+}
+
+// the block format for image, or 0 to leave it uncompressed. With rgba set
+// the image has 4 channels and gets BC3 even if it is opaque
+GLenum compressed_format(const Image &image,
+                         const TextureCompression &compression, bool rgba) {
+  if (image.width % 4 != 0 || image.height % 4 != 0)
+    return 0;
+  if (rgba)
+    return compression.s3tc ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : 0;
+  switch (image.channels) {
+  case 1:
+    return compression.rgtc ? GL_COMPRESSED_RED_RGTC1 : 0;
+  case 2:
+    return compression.rgtc ? GL_COMPRESSED_RG_RGTC2 : 0;
+  case 3:
+    return compression.s3tc ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : 0;
+  default:
+    if (!compression.s3tc)
+      return 0;
+    return opaque(image) ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                         : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  }
+}
+
+void uncompressed_format(int channels, GLenum *internal_format,
+                         GLenum *format) {
+  switch (channels) {
+  case 1:
+    *internal_format = GL_R8;
+    *format = GL_RED;
+    break;
+  case 2:
+    *internal_format = GL_RG8;
+    *format = GL_RG;
+    break;
+  case 3:
+    *internal_format = GL_RGB8;
+    *format = GL_RGB;
+    break;
+  default:
+    *internal_format = GL_RGBA8;
+    *format = GL_RGBA;
+  }
+}
+
+// written under a temporary name first, like ModelAsset::write_cache
+bool write_baked_texture(const std::string &source_path, bool flip,
+                         bool mipmaps, const TextureCompression &compression,
+                         bool rgba, float decode_milliseconds,
+                         const BakedTexture &texture) {
+  std::string path =
+      baked_path(source_path, flip, mipmaps, compression, rgba);
+  std::string temporary_path = path + ".tmp";
+  bool written;
+  {
+    BinaryWriter writer(temporary_path);
+    writer.write<uint32_t>(baked_magic);
+    writer.write<uint32_t>(baked_version);
+    writer.write(SourceStamp::of(source_path));
+    writer.write<uint32_t>(flip);
+    writer.write<uint32_t>(mipmaps);
+    writer.write<uint32_t>(compression.s3tc);
+    writer.write<uint32_t>(compression.rgtc);
+    writer.write<uint32_t>(rgba);
+    writer.write<float>(decode_milliseconds);
+    writer.write<uint32_t>(texture.internal_format);
+    writer.write<uint32_t>(texture.format);
+    writer.write<uint32_t>(texture.compressed);
+    writer.write<uint32_t>(texture.channels);
+    writer.write<uint32_t>(texture.levels.size());
+    for (const TextureLevel &level : texture.levels) {
+      writer.write<int32_t>(level.width);
+      writer.write<int32_t>(level.height);
+      writer.write<uint64_t>(level.size);
+      writer.write_array(level.data, level.size);
+    }
+    written = writer.ok();
+  }
+  if (!written || std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    std::remove(temporary_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+// false if the baked file is missing, or was written by another
+// baked_version, with other settings or from an older source
+bool read_baked_texture(const std::string &source_path, bool flip,
+                        bool mipmaps, const TextureCompression &compression,
+                        bool rgba, BakedTexture &texture,
+                        float *decode_milliseconds) {
+  auto mapping = std::make_shared<MappedFile>();
+  if (!mapping->open(
+          baked_path(source_path, flip, mipmaps, compression, rgba)))
+    return false;
+  BinaryReader reader(mapping->data(), mapping->size());
+  bool matches = reader.read<uint32_t>() == baked_magic &&
+                 reader.read<uint32_t>() == baked_version &&
+                 reader.read<SourceStamp>() == SourceStamp::of(source_path) &&
+                 reader.read<uint32_t>() == (uint32_t)flip &&
+                 reader.read<uint32_t>() == (uint32_t)mipmaps &&
+                 reader.read<uint32_t>() == (uint32_t)compression.s3tc &&
+                 reader.read<uint32_t>() == (uint32_t)compression.rgtc &&
+                 reader.read<uint32_t>() == (uint32_t)rgba;
+  if (!matches)
+    return false;
+
+  *decode_milliseconds = reader.read<float>();
+  texture.internal_format = reader.read<uint32_t>();
+  texture.format = reader.read<uint32_t>();
+  texture.compressed = reader.read<uint32_t>();
+  texture.channels = reader.read<uint32_t>();
+  uint32_t level_count = reader.read<uint32_t>();
+  for (uint32_t i = 0; i < level_count && reader.ok(); i++) {
+    TextureLevel level;
+    level.width = reader.read<int32_t>();
+    level.height = reader.read<int32_t>();
+    level.size = reader.read<uint64_t>();
+    level.data = reader.read_array<unsigned char>(level.size);
+    texture.levels.push_back(level);
+  }
+  if (!reader.ok() || texture.levels.empty()) {
+    texture = BakedTexture();
+    return false;
+  }
+  texture.storage = mapping;
+  return true;
+}
+
+} // namespace
+
+TextureCompression TextureCompression::supported() {
+  TextureCompression compression;
+  compression.rgtc = true; // core since 3.0
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++) {
+    const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+    if (name && std::strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+      compression.s3tc = true;
+  }
+  return compression;
+}
+
+BakedTexture bake_texture(const Image &source, bool mipmaps,
+                          const TextureCompression &compression, bool rgba) {
+  Image image =
+      rgba && source.channels != 4 ? expand_to_rgba(source) : source;
+  BakedTexture texture;
+  texture.channels = image.channels;
+  texture.internal_format = compressed_format(image, compression, rgba);
+  texture.compressed = texture.internal_format != 0;
+  if (!texture.compressed)
+    uncompressed_format(image.channels, &texture.internal_format,
+                        &texture.format);
+
+  // every level goes into one buffer, so the texture owns a single block
+  std::vector<std::vector<unsigned char>> levels;
+  std::vector<std::pair<int, int>> sizes;
+  std::vector<unsigned char> pixels(image.pixels.get(),
+                                    image.pixels.get() + size_t(image.width) *
+                                                             image.height *
+                                                             image.channels);
+  int width = image.width, height = image.height;
+  while (true) {
+    if (texture.compressed)
+      levels.push_back(compress_level(pixels.data(), width, height,
+                                      image.channels, texture.internal_format));
+    else
+      levels.push_back(pixels);
+    sizes.push_back({width, height});
+    if (!mipmaps || (width == 1 && height == 1))
+      break;
+    pixels = downsample(pixels.data(), width, height, image.channels);
+    width = std::max(1, width / 2);
+    height = std::max(1, height / 2);
+  }
+
+  auto storage = std::make_shared<std::vector<unsigned char>>();
+  for (const std::vector<unsigned char> &level : levels)
+    storage->insert(storage->end(), level.begin(), level.end());
+  size_t offset = 0;
+  for (size_t i = 0; i < levels.size(); i++) {
+    texture.levels.push_back({sizes[i].first, sizes[i].second,
+                              storage->data() + offset, levels[i].size()});
+    offset += levels[i].size();
+  }
+  texture.storage = storage;
+  return texture;
+}
+
+std::string baked_path(const std::string &source_path, bool flip,
+                       bool mipmaps, const TextureCompression &compression,
+                       bool rgba) {
+  unsigned settings = flip | mipmaps << 1 | compression.s3tc << 2 |
+                      compression.rgtc << 3 | rgba << 4;
+  return source_path + "." + std::to_string(settings) + ".texcache";
+}
+
+BakedTexture load_baked_texture(const std::string &source_path, bool flip,
+                                bool mipmaps,
+                                const TextureCompression &compression,
+                                bool rgba, TextureBakeReport *report) {
+  auto start = std::chrono::steady_clock::now();
+  BakedTexture texture;
+  float decode_milliseconds = 0.0f;
+  bool from_cache = read_baked_texture(source_path, flip, mipmaps, compression,
+                                       rgba, texture, &decode_milliseconds);
+  if (!from_cache) {
+    Image image = read_image(source_path, flip);
+    std::chrono::duration<float, std::milli> decoded =
+        std::chrono::steady_clock::now() - start;
+    decode_milliseconds = decoded.count();
+    texture = bake_texture(image, mipmaps, compression, rgba);
+    write_baked_texture(source_path, flip, mipmaps, compression, rgba,
+                        decode_milliseconds, texture);
+  }
+
+  if (report) {
+    std::chrono::duration<float, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    report->path = source_path;
+    report->from_cache = from_cache;
+    report->milliseconds = elapsed.count();
+    report->decode_milliseconds = decode_milliseconds;
+    report->bytes_before = 0;
+    for (const TextureLevel &level : texture.levels)
+      report->bytes_before += size_t(level.width) * level.height * texture.channels;
+    report->bytes_after = texture.bytes();
+    report->internal_format = texture.internal_format;
+  }
+  return texture;
+}
+
+void upload_baked_level(GLenum target, const BakedTexture &texture,
+                        size_t level, const void *pixels) {
+  const TextureLevel &mip = texture.levels[level];
+  if (texture.compressed)
+    glCompressedTexImage2D(target, level, texture.internal_format, mip.width,
+                           mip.height, 0, mip.size, pixels);
+  else
+    glTexImage2D(target, level, texture.internal_format, mip.width,
+                 mip.height, 0, texture.format, GL_UNSIGNED_BYTE, pixels);
+}
+
+const char *texture_format_name(GLenum internal_format) {
+  switch (internal_format) {
+  case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    return "BC1";
+  case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    return "BC3";
+  case GL_COMPRESSED_RED_RGTC1:
+    return "BC4";
+  case GL_COMPRESSED_RG_RGTC2:
+    return "BC5";
+  case GL_R8:
+    return "R8";
+  case GL_RG8:
+    return "RG8";
+  case GL_RGB8:
+    return "RGB8";
+  default:
+    return "RGBA8";
+  }
+}
@@ -0,0 +1,121 @@
+#ifndef TEXTURE_BAKER_HPP
+#define TEXTURE_BAKER_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../include/glad/glad.h"
+
+#include "helpers.hpp"
+
+// S3TC is an extension glad wasn't generated with
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+/* textures baked into exactly what the GPU is given: every mip level,
+filtered on the CPU, and block compressed where the driver can sample the
+result. A baked texture is written next to its source (see baked_path), so
+later runs map that file and upload straight from the mapping instead of
+decoding the PNG or JPG and having the driver build the mips.
+
+Which block format a texture gets depends on its channels:
+
+- 1 channel: BC4 (RGTC1)
+- 2 channels: BC5 (RGTC2)
+- 3 channels, or 4 with every pixel opaque: BC1 (DXT1)
+- 4 channels: BC3 (DXT5)
+
+Baking with rgba set expands every image to 4 channels and skips the opaque
+case, so it always ends up BC3 (or RGBA8 uncompressed). The faces of a cube
+map are baked that way, since a cube map whose faces differ in format is
+incomplete.
+
+RGTC is core since GL 3.0, S3TC needs GL_EXT_texture_compression_s3tc.
+Textures whose size isn't a multiple of 4 stay uncompressed */
+
+// the block formats a driver can sample
+struct TextureCompression {
+  bool s3tc = false; // BC1 and BC3
+  bool rgtc = false; // BC4 and BC5
+
+  // what the current context supports. GL thread only
+  static TextureCompression supported();
+};
+
+// one mip level, pointing into its BakedTexture's storage
+struct TextureLevel {
+  int width;
+  int height;
+  const unsigned char *data;
+  size_t size;
+};
+
+/* a texture ready for glTexImage2D, or glCompressedTexImage2D when
+compressed, one call per level. Copies share the storage, which is either
+the mapped baked file or the buffer bake_texture filled in */
+struct BakedTexture {
+  GLenum internal_format = 0;
+  GLenum format = 0; // pixel format of uncompressed levels
+  bool compressed = false;
+  int channels = 0;
+  std::vector<TextureLevel> levels;
+  std::shared_ptr<const void> storage;
+
+  // GPU memory the levels take up
+  size_t bytes() const {
+    size_t total = 0;
+    for (const TextureLevel &level : levels)
+      total += level.size;
+    return total;
+  }
+};
+
+// how one texture was loaded, for the startup report
+struct TextureBakeReport {
+  std::string path;
+  bool from_cache;
+  float milliseconds;        // this load, decode and bake included if cold
+  float decode_milliseconds; // what decoding the source took when baking it
+  size_t bytes_before;       // 8 bit texels with a full mip chain
+  size_t bytes_after;        // what the baked levels take up
+  GLenum internal_format;
+};
+
+// the full chain if mipmaps, level 0 only otherwise, compressed if
+// compression has the block format the image needs. No GL
+BakedTexture bake_texture(const Image &image, bool mipmaps,
+                          const TextureCompression &compression,
+                          bool rgba = false);
+
+/* where source_path baked with these settings is kept: next to the source,
+named after the settings too, so every variant of one image has a file of
+its own */
+std::string baked_path(const std::string &source_path, bool flip,
+                       bool mipmaps, const TextureCompression &compression,
+                       bool rgba);
+
+/* source_path baked as flip, mipmaps, compression and rgba ask for: read
+from the baked file if it was written with those settings from the source as
+it is now, otherwise decoded, baked and written out for next time. No GL, so
+it may run on any thread. Throws if the source can't be decoded */
+BakedTexture load_baked_texture(const std::string &source_path, bool flip,
+                                bool mipmaps,
+                                const TextureCompression &compression,
+                                bool rgba, TextureBakeReport *report = nullptr);
+
+/* specifies one level of the texture bound to target (or one of a cube map's
+faces) from pixels, which is an offset instead while a
+GL_PIXEL_UNPACK_BUFFER is bound. Expects GL_UNPACK_ALIGNMENT 1. GL thread
+only */
+void upload_baked_level(GLenum target, const BakedTexture &texture,
+                        size_t level, const void *pixels);
+
+// a name for internal_format, such as "BC1" or "RGBA8"
+const char *texture_format_name(GLenum internal_format);
+
+#endif
@@ -0,0 +1,369 @@
+#ifndef TEXTURE_CACHE_HPP
+#define TEXTURE_CACHE_HPP
+
+#include <climits>
+#include <cstdlib>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../include/glad/glad.h"
+
+#include "asset_loader.hpp"
+#include "gl_object.hpp"
+#include "helpers.hpp"
+#include "texture_baker.hpp"
+#include "texture_streamer.hpp"
+
+/* how a texture is decoded and sampled. Part of the TextureCache key, so the
+same file with other parameters is a different texture */
+struct TextureParams {
+  GLint wrap = GL_REPEAT;
+  GLint min_filter = GL_LINEAR_MIPMAP_LINEAR;
+  GLint mag_filter = GL_LINEAR;
+  bool mipmaps = true;
+  bool flip = false;    // rows flipped while decoding, bottom row first
+  bool compress = true; // block compressed, if the driver supports it
+
+  std::string key() const {
+    return std::to_string(wrap) + "," + std::to_string(min_filter) + "," +
+           std::to_string(mag_filter) + (mipmaps ? "m" : "") +
+           (flip ? "f" : "") + (compress ? "c" : "");
+  }
+};
+
+// what the cache has done so far
+struct TextureCacheStats {
+  int decodes = 0; // images baked or read from their baked file, six per
+                   // cube map
+  int uploads = 0; // textures created
+  int hits = 0;    // loads answered with a texture already there
+};
+
+/* every texture the process loads, decoded and uploaded once per (canonical
+path, TextureParams) for as long as anything holds its handle. Images go
+through load_baked_texture, so after the first run they come straight from
+their baked file with the mips already there. Like
+ModelCache, the cache only keeps weak references: a texture is deleted with
+the last handle, and loading it again after that starts over.
+
+prefetch() decodes on whichever thread calls it, so loaders can decode on
+their workers; the image waits in the cache for the load() on the GL thread
+that uploads it. A texture being decoded by one thread is never decoded
+again by another, which waits for the first instead */
+class TextureCache {
+public:
+  using Handle = std::shared_ptr<GLTexture>;
+
+  // decodes path unless it is uploaded or being decoded already. Any thread
+  void prefetch(const std::string &path, const TextureParams &params) {
+    std::vector<std::string> paths = {canonical(path)};
+    decode(key_of(GL_TEXTURE_2D, paths, params), GL_TEXTURE_2D, paths, params);
+  }
+
+  // the texture at path, decoded (unless prefetched) and uploaded the first
+  // time. GL thread only
+  Handle load(const std::string &path, const TextureParams &params) {
+    return acquire(GL_TEXTURE_2D, {canonical(path)}, params);
+  }
+
+  // faces in the order +x, -x, +y, -y, +z, -z. GL thread only
+  Handle load_cube_map(const std::vector<std::string> &faces,
+                       const TextureParams &params) {
+    return acquire(GL_TEXTURE_CUBE_MAP, canonical(faces), params);
+  }
+
+  /* like load, but a texture not in the cache yet is decoded on one of
+  loader's workers. The handle is valid at once and the image shows up once
+  loader has run the upload. GL thread only */
+  Handle load_async(AssetLoader &loader, const std::string &path,
+                    const TextureParams &params) {
+    return acquire_async(loader, GL_TEXTURE_2D, {canonical(path)}, params);
+  }
+
+  Handle load_cube_map_async(AssetLoader &loader,
+                             const std::vector<std::string> &faces,
+                             const TextureParams &params) {
+    return acquire_async(loader, GL_TEXTURE_CUBE_MAP, canonical(faces),
+                         params);
+  }
+
+  TextureCacheStats get_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+  }
+
+  // one per image baked or read baked so far
+  std::vector<TextureBakeReport> get_reports() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return reports;
+  }
+
+  // the block formats textures may be baked to from now on, normally
+  // TextureCompression::supported(). Nothing is compressed until this is set
+  void set_compression(const TextureCompression &supported) {
+    std::lock_guard<std::mutex> lock(mutex);
+    compression = supported;
+  }
+
+  /* streamer gets every mipmapped 2D texture uploaded from now on, which
+  then starts out as its coarse levels (see TextureStreamer). Null uploads
+  whole textures again. The cache doesn't own streamer; clear it before
+  streamer goes away. GL thread only */
+  void set_streamer(TextureStreamer *streamer) { this->streamer = streamer; }
+
+  // tells the streamer, if any, that texture is drawn this frame. GL thread
+  // only
+  void touch(const Handle &texture) {
+    if (streamer && texture)
+      streamer->touch(texture->id());
+  }
+
+  // the cache ModelAsset, Grass, Quad and Sky load through
+  static TextureCache &shared() {
+    static TextureCache cache;
+    return cache;
+  }
+
+private:
+  using Images = std::vector<BakedTexture>;
+
+  struct Entry {
+    std::weak_ptr<GLTexture> texture;
+    // set from the start of a decode until the image is uploaded
+    std::shared_future<Images> images;
+    // counts decodes started, telling a decode's images from a later one's
+    unsigned decode_id = 0;
+  };
+
+  std::mutex mutex;
+  std::unordered_map<std::string, Entry> entries;
+  TextureCacheStats stats;
+  std::vector<TextureBakeReport> reports;
+  TextureCompression compression;
+  TextureStreamer *streamer = nullptr; // GL thread only, so no lock
+
+  static std::string canonical(const std::string &path) {
+    char resolved[PATH_MAX];
+    return realpath(path.c_str(), resolved) ? std::string(resolved) : path;
+  }
+
+  static std::vector<std::string>
+  canonical(const std::vector<std::string> &paths) {
+    std::vector<std::string> result;
+    for (const std::string &path : paths)
+      result.push_back(canonical(path));
+    return result;
+  }
+
+  static std::string key_of(GLenum target,
+                            const std::vector<std::string> &paths,
+                            const TextureParams &params) {
+    std::string key = std::to_string(target) + "|" + params.key();
+    for (const std::string &path : paths)
+      key += "|" + path;
+    return key;
+  }
+
+  Images read(GLenum target, const std::vector<std::string> &paths,
+             const TextureParams &params) {
+    TextureCompression allowed;
+    if (params.compress) {
+      std::lock_guard<std::mutex> lock(mutex);
+      allowed = compression;
+    }
+    // a cube map is only complete if every face has the same format
+    bool rgba = target == GL_TEXTURE_CUBE_MAP;
+    Images images;
+    std::vector<TextureBakeReport> loaded(paths.size());
+    for (size_t i = 0; i < paths.size(); i++)
+      images.push_back(load_baked_texture(paths[i], params.flip,
+                                          params.mipmaps, allowed, rgba,
+                                          &loaded[i]));
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.decodes += images.size();
+    reports.insert(reports.end(), loaded.begin(), loaded.end());
+    return images;
+  }
+
+  void decode(const std::string &key, GLenum target,
+              const std::vector<std::string> &paths,
+              const TextureParams &params) {
+    std::promise<Images> decoded;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Entry &entry = entries[key];
+      if (!entry.texture.expired() || entry.images.valid())
+        return;
+      entry.images = decoded.get_future().share();
+      entry.decode_id++;
+    }
+    fulfil(decoded, target, paths, params);
+  }
+
+  // a failed decode is rethrown by the load that goes to upload it
+  void fulfil(std::promise<Images> &decoded, GLenum target,
+              const std::vector<std::string> &paths,
+              const TextureParams &params) {
+    try {
+      decoded.set_value(read(target, paths, params));
+    } catch (...) {
+      decoded.set_exception(std::current_exception());
+    }
+  }
+
+  // drops key's images once uploaded or failed, unless a later decode
+  // replaced them meanwhile
+  void forget_images(const std::string &key, unsigned decode_id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &entry = entries[key];
+    if (entry.decode_id == decode_id)
+      entry.images = std::shared_future<Images>();
+  }
+
+  Handle acquire(GLenum target, const std::vector<std::string> &paths,
+                 const TextureParams &params) {
+    std::string key = key_of(target, paths, params);
+    if (Handle texture = find(key))
+      return texture;
+
+    decode(key, target, paths, params);
+    std::shared_future<Images> images;
+    unsigned decode_id;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      images = entries[key].images;
+      decode_id = entries[key].decode_id;
+    }
+    Handle texture = std::make_shared<GLTexture>(GLTexture::generate());
+    try {
+      upload(texture, target, images.get(), params);
+    } catch (...) {
+      // forget the failed decode, so a later load tries again
+      forget_images(key, decode_id);
+      throw;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      entries[key].texture = texture;
+      stats.uploads++;
+    }
+    // only now, so a prefetch in between finds the texture instead of
+    // decoding it again
+    forget_images(key, decode_id);
+    return texture;
+  }
+
+  Handle acquire_async(AssetLoader &loader, GLenum target,
+                       const std::vector<std::string> &paths,
+                       const TextureParams &params) {
+    std::string key = key_of(target, paths, params);
+    if (Handle texture = find(key))
+      return texture;
+
+    /* registered before the image exists, so loads meanwhile share the
+    name. The decode is claimed here as well, on the GL thread, unless a
+    prefetch has one running already; the worker then waits for that one */
+    Handle texture = std::make_shared<GLTexture>(GLTexture::generate());
+    std::shared_ptr<std::promise<Images>> decoded;
+    std::shared_future<Images> images;
+    unsigned decode_id;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Entry &entry = entries[key];
+      entry.texture = texture;
+      if (!entry.images.valid()) {
+        decoded = std::make_shared<std::promise<Images>>();
+        entry.images = decoded->get_future().share();
+        entry.decode_id++;
+      }
+      images = entry.images;
+      decode_id = entry.decode_id;
+      stats.uploads++;
+    }
+    if (streamer && target == GL_TEXTURE_2D)
+      upload_placeholder(*texture);
+    std::weak_ptr<GLTexture> weak = texture;
+    loader.load([this, key, weak, target, paths, params, decoded, images,
+                 decode_id]() -> AssetLoader::Upload {
+      if (decoded)
+        fulfil(*decoded, target, paths, params);
+      try {
+        // waits for a prefetch still decoding. A failure is rethrown here,
+        // on the worker, so the loader reports it
+        images.get();
+      } catch (...) {
+        // a later load tries again
+        forget_images(key, decode_id);
+        throw;
+      }
+      return [this, key, weak, target, images, params, decode_id] {
+        forget_images(key, decode_id);
+        // nothing to fill in if every handle went away meanwhile
+        if (Handle texture = weak.lock())
+          upload(texture, target, images.get(), params);
+      };
+    });
+    return texture;
+  }
+
+  Handle find(const std::string &key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = entries.find(key);
+    if (entry == entries.end())
+      return nullptr;
+    Handle texture = entry->second.texture.lock();
+    if (texture)
+      stats.hits++;
+    return texture;
+  }
+
+  // a grey texel for a texture whose image is still being decoded
+  static void upload_placeholder(const GLTexture &texture) {
+    static const unsigned char grey[4] = {128, 128, 128, 255};
+    glBindTexture(GL_TEXTURE_2D, texture.id());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, grey);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  // one image for GL_TEXTURE_2D, six faces for GL_TEXTURE_CUBE_MAP
+  void upload(const Handle &texture, GLenum target, const Images &images,
+              const TextureParams &params) {
+    glBindTexture(target, texture->id());
+    // baked rows are tightly packed
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (streamer && target == GL_TEXTURE_2D && images.size() == 1 &&
+        images[0].levels.size() > 1) {
+      streamer->add(texture, images[0]);
+    } else {
+      for (size_t i = 0; i < images.size(); i++) {
+        GLenum face = target == GL_TEXTURE_CUBE_MAP
+                          ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + i
+                          : target;
+        for (size_t level = 0; level < images[i].levels.size(); level++)
+          upload_baked_level(face, images[i], level,
+                             images[i].levels[level].data);
+      }
+      // the chain was baked, so no glGenerateMipmap
+      glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+      glTexParameteri(target, GL_TEXTURE_MAX_LEVEL,
+                      images.empty() ? 0 : images[0].levels.size() - 1);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, params.wrap);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, params.wrap);
+    if (target == GL_TEXTURE_CUBE_MAP)
+      glTexParameteri(target, GL_TEXTURE_WRAP_R, params.wrap);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, params.min_filter);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, params.mag_filter);
+    glBindTexture(target, 0);
+  }
+};
+
+#endif
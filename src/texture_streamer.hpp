@@ -0,0 +1,272 @@
+#ifndef TEXTURE_STREAMER_HPP
+#define TEXTURE_STREAMER_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "../include/glad/glad.h"
+
+#include "gl_object.hpp"
+#include "texture_baker.hpp"
+
+struct TextureStreamingOptions {
+  // texel data copied into the pixel buffer and uploaded per update()
+  size_t upload_bytes_per_frame = 2 << 20;
+  // what the streamed textures may take up before idle ones lose fine mips
+  size_t vram_bytes = 128 << 20;
+  // frames without a touch() before a texture stops streaming in and may be
+  // evicted
+  int idle_frames = 300;
+  // levels at most this many texels a side are uploaded as soon as the
+  // texture is added, so it never samples nothing
+  int placeholder_size = 32;
+};
+
+struct TextureStreamingStats {
+  int textures = 0;          // textures with levels that stream
+  size_t resident_bytes = 0; // levels of those textures in GPU memory
+  size_t pending_bytes = 0;  // levels of textures in use still to come
+  size_t uploaded_bytes = 0; // in the last update()
+  int evictions = 0;         // times a texture dropped its fine levels
+};
+
+/* mipmapped textures that start as their coarsest levels and get their
+finer ones over the following frames, coarse to fine, through a pixel
+buffer object. update() uploads at most upload_bytes_per_frame per frame,
+except that a single level bigger than that goes up alone, so no frame
+stalls on a large texture.
+
+Textures not touch()ed for idle_frames are least recently used ones. While
+the streamed textures take up more than vram_bytes, those drop their levels
+back down to the placeholder, from the longest unused on, by raising
+GL_TEXTURE_BASE_LEVEL and releasing the finer levels. They stream in again
+once touched.
+
+Only the textures given to add() are counted. Every one keeps its
+BakedTexture, which is a mapping of the baked file unless the texture was
+baked this run. GL thread only */
+class TextureStreamer {
+public:
+  explicit TextureStreamer(
+      const TextureStreamingOptions &options = TextureStreamingOptions())
+      : options(options), frame(0), resident_bytes(0) {}
+
+  TextureStreamer(const TextureStreamer &) = delete;
+  TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+  /* specifies image's levels of at most placeholder_size texels a side for
+  texture, which must be bound to GL_TEXTURE_2D, and streams the rest in
+  over the following update()s. Sets the base and max level */
+  void add(const std::shared_ptr<GLTexture> &texture,
+           const BakedTexture &image) {
+    int last = image.levels.size() - 1;
+    int coarse = 0;
+    while (coarse < last &&
+           (image.levels[coarse].width > options.placeholder_size ||
+            image.levels[coarse].height > options.placeholder_size))
+      coarse++;
+
+    Resident resident;
+    resident.texture = texture;
+    resident.id = texture->id();
+    resident.image = image;
+    resident.base_level = coarse;
+    resident.coarse_level = coarse;
+    resident.bytes = 0;
+    resident.last_used = frame;
+    for (int level = coarse; level <= last; level++) {
+      upload_baked_level(GL_TEXTURE_2D, image, level,
+                         image.levels[level].data);
+      resident.bytes += image.levels[level].size;
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, coarse);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, last);
+    forget(resident.id);
+    if (coarse == 0)
+      return; // nothing left to stream
+
+    resident_bytes += resident.bytes;
+    lru.push_front(std::move(resident));
+    residents[lru.front().id] = lru.begin();
+  }
+
+  // marks the texture as used this frame. Cheap for textures not streamed
+  void touch(GLuint texture) {
+    auto found = residents.find(texture);
+    if (found == residents.end() || found->second->last_used == frame)
+      return;
+    found->second->last_used = frame;
+    lru.splice(lru.begin(), lru, found->second);
+  }
+
+  // streams the next levels in and evicts over budget. Once per frame, after
+  // the frame's touch()es
+  void update() {
+    for (auto resident = lru.begin(); resident != lru.end();)
+      if (resident->texture.expired())
+        resident = erase(resident);
+      else
+        ++resident;
+
+    stream();
+    evict();
+
+    stats.textures = lru.size();
+    stats.resident_bytes = resident_bytes;
+    stats.pending_bytes = 0;
+    for (const Resident &resident : lru) {
+      if (idle(resident))
+        break;
+      for (int level = 0; level < resident.base_level; level++)
+        stats.pending_bytes += resident.image.levels[level].size;
+    }
+    frame++;
+  }
+
+  TextureStreamingStats get_stats() const { return stats; }
+
+private:
+  struct Resident {
+    std::weak_ptr<GLTexture> texture;
+    GLuint id;
+    BakedTexture image;
+    int base_level;   // finest level specified
+    int coarse_level; // the placeholder's finest level
+    size_t bytes;     // levels base_level and coarser
+    uint64_t last_used;
+  };
+
+  // a level of one texture, placed in the pixel buffer
+  struct Upload {
+    Resident *resident;
+    int level;
+    size_t offset;
+  };
+
+  TextureStreamingOptions options;
+  uint64_t frame;
+  size_t resident_bytes;
+  TextureStreamingStats stats;
+  // most recently used first
+  std::list<Resident> lru;
+  std::unordered_map<GLuint, std::list<Resident>::iterator> residents;
+  GLBuffer pixel_buffer;
+
+  bool idle(const Resident &resident) const {
+    return frame - resident.last_used > (uint64_t)options.idle_frames;
+  }
+
+  std::list<Resident>::iterator erase(std::list<Resident>::iterator resident) {
+    auto found = residents.find(resident->id);
+    if (found != residents.end() && found->second == resident)
+      residents.erase(found);
+    resident_bytes -= resident->bytes;
+    return lru.erase(resident);
+  }
+
+  // drops what is tracked under a texture name a deleted texture had
+  void forget(GLuint id) {
+    auto found = residents.find(id);
+    if (found != residents.end())
+      erase(found->second);
+  }
+
+  // the next finer level of every texture in use, most recently used first,
+  // as far as the budget goes
+  void stream() {
+    std::vector<Upload> uploads;
+    size_t total = 0;
+    for (Resident &resident : lru) {
+      if (idle(resident))
+        break; // and so is everything after it
+      if (resident.base_level == 0)
+        continue;
+      int level = resident.base_level - 1;
+      size_t size = resident.image.levels[level].size;
+      if (!uploads.empty() && total + size > options.upload_bytes_per_frame)
+        continue;
+      uploads.push_back({&resident, level, total});
+      // offsets stay 16 byte aligned, like the baked file's arrays
+      total += (size + 15) & ~size_t(15);
+      if (total >= options.upload_bytes_per_frame)
+        break;
+    }
+    stats.uploaded_bytes = 0;
+    if (uploads.empty())
+      return;
+
+    if (!pixel_buffer)
+      pixel_buffer = GLBuffer::generate();
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer.id());
+    // orphans last frame's storage, which the GPU may still be reading
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, total, nullptr, GL_STREAM_DRAW);
+    char *mapped = static_cast<char *>(glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, total,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    if (!mapped) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      return; // tried again next frame
+    }
+    for (const Upload &upload : uploads) {
+      const TextureLevel &level = upload.resident->image.levels[upload.level];
+      std::memcpy(mapped + upload.offset, level.data, level.size);
+    }
+    if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+      // the buffer's contents were lost, so upload next frame
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      return;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (const Upload &upload : uploads) {
+      Resident &resident = *upload.resident;
+      size_t size = resident.image.levels[upload.level].size;
+      glBindTexture(GL_TEXTURE_2D, resident.id);
+      upload_baked_level(GL_TEXTURE_2D, resident.image, upload.level,
+                         reinterpret_cast<const void *>(upload.offset));
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, upload.level);
+      resident.base_level = upload.level;
+      resident.bytes += size;
+      resident_bytes += size;
+      stats.uploaded_bytes += size;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+
+  // back to the placeholder for idle textures, least recently used first,
+  // until the streamed textures fit in vram_bytes
+  void evict() {
+    for (auto resident = lru.rbegin();
+         resident != lru.rend() && resident_bytes > options.vram_bytes;
+         ++resident) {
+      if (!idle(*resident))
+        break; // and so is everything before it
+      if (resident->base_level == resident->coarse_level)
+        continue;
+      const BakedTexture &image = resident->image;
+      GLenum format = image.compressed ? GL_RGBA : image.format;
+      glBindTexture(GL_TEXTURE_2D, resident->id);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL,
+                      resident->coarse_level);
+      for (int level = resident->base_level; level < resident->coarse_level;
+           level++) {
+        // an empty image releases the level's storage
+        glTexImage2D(GL_TEXTURE_2D, level, image.internal_format, 0, 0, 0,
+                     format, GL_UNSIGNED_BYTE, nullptr);
+        resident->bytes -= image.levels[level].size;
+        resident_bytes -= image.levels[level].size;
+      }
+      resident->base_level = resident->coarse_level;
+      stats.evictions++;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+};
+
+#endif
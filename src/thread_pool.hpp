@@ -0,0 +1,120 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads pulling jobs from a single queue.
+class ThreadPool {
+public:
+  ThreadPool(unsigned int num_threads = std::thread::hardware_concurrency()) {
+    // the calling thread also works during parallel_for, so leave it a core
+    num_threads = std::max(1u, num_threads) - 1;
+    for (unsigned int i = 0; i < num_threads; i++)
+      workers.emplace_back([this] { work(); });
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+      worker.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // number of threads taking part in parallel_for, including the caller
+  size_t size() const { return workers.size() + 1; }
+
+  void submit(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back(std::move(job));
+    }
+    wake.notify_one();
+  }
+
+  // Calls job(begin, end) over [0, count) in chunks of grain, and returns
+  // once every chunk is done. The calling thread takes chunks too.
+  void parallel_for(size_t count, size_t grain,
+                    const std::function<void(size_t, size_t)> &job) {
+    if (count == 0)
+      return;
+
+    // helpers that start after the last chunk is taken still read this, so
+    // it is shared rather than living on the caller's stack
+    auto batch = std::make_shared<Batch>();
+    batch->count = count;
+    batch->grain = std::max<size_t>(1, grain);
+    batch->num_chunks = (count + batch->grain - 1) / batch->grain;
+    batch->job = &job;
+
+    size_t helpers = std::min(workers.size(), batch->num_chunks - 1);
+    for (size_t i = 0; i < helpers; i++)
+      submit([batch] { batch->run(); });
+    batch->run();
+
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->done.wait(lock, [&] {
+      return batch->chunks_done.load() == batch->num_chunks;
+    });
+  }
+
+private:
+  struct Batch {
+    std::atomic<size_t> next_chunk{0};
+    std::atomic<size_t> chunks_done{0};
+    size_t count;
+    size_t grain;
+    size_t num_chunks;
+    const std::function<void(size_t, size_t)> *job;
+    std::mutex mutex;
+    std::condition_variable done;
+
+    void run() {
+      size_t chunk;
+      while ((chunk = next_chunk.fetch_add(1)) < num_chunks) {
+        size_t begin = chunk * grain;
+        (*job)(begin, std::min(count, begin + grain));
+        if (chunks_done.fetch_add(1) + 1 == num_chunks) {
+          std::lock_guard<std::mutex> lock(mutex);
+          done.notify_all();
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> jobs;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  void work() {
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+        if (stopping && jobs.empty())
+          return;
+        job = std::move(jobs.front());
+        jobs.pop_front();
+      }
+      job();
+    }
+  }
+};
+
+#endif
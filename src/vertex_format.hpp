@@ -0,0 +1,207 @@
+#ifndef VERTEX_FORMAT_HPP
+#define VERTEX_FORMAT_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "../include/glad/glad.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#define MAX_BONE_WEIGHTS 4
+
+// a vertex as imported, before it is packed into one of the layouts below
+struct Vertex {
+  glm::vec3 position;
+  glm::vec3 normal;
+  glm::vec2 textureCoords;
+
+  // animation related.
+  int boneIds[MAX_BONE_WEIGHTS];
+  float weights[MAX_BONE_WEIGHTS];
+};
+
+/* what a mesh keeps per vertex on the GPU. Every layout starts with a float
+position, an octahedral normal in two snorm16 and half float texture
+coordinates; skinned layouts add bone ids and unorm8 weights. Unused weight
+slots are zero, with bone id 0. Vertex shaders decode the normal with
+octDecode (see character_vertex.glsl) */
+enum class VertexLayout : uint32_t {
+  static_mesh,  // 20 bytes, no bone data
+  skinned,      // 28 bytes, uint8 bone ids
+  skinned_wide, // 32 bytes, uint16 bone ids for more than 256 bones
+};
+
+// where a layout's attributes are in a vertex
+struct VertexFormat {
+  int stride;
+  GLenum bone_id_type; // 0 for layouts without bone data
+  int bone_ids_offset;
+  int weights_offset;
+
+  static constexpr int position_offset = 0;
+  static constexpr int normal_offset = 12;
+  static constexpr int texture_coords_offset = 16;
+
+  static VertexFormat of(VertexLayout layout) {
+    switch (layout) {
+    case VertexLayout::skinned:
+      return {28, GL_UNSIGNED_BYTE, 20, 24};
+    case VertexLayout::skinned_wide:
+      return {32, GL_UNSIGNED_SHORT, 20, 28};
+    default:
+      return {20, 0, 0, 0};
+    }
+  }
+
+  /* sets up attributes 0 to 4 of the bound vertex array from the bound
+  array buffer: position, normal, texture coords, bone ids and weights. The
+  bone attributes are left disabled for static meshes */
+  void set_attributes() const {
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride,
+                          (void *)(intptr_t)position_offset);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride,
+                          (void *)(intptr_t)normal_offset);
+    set_texture_coords_attribute(2);
+    if (bone_id_type == 0) {
+      glDisableVertexAttribArray(3);
+      glDisableVertexAttribArray(4);
+      return;
+    }
+    glEnableVertexAttribArray(3);
+    glVertexAttribIPointer(3, MAX_BONE_WEIGHTS, bone_id_type, stride,
+                           (void *)(intptr_t)bone_ids_offset);
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, MAX_BONE_WEIGHTS, GL_UNSIGNED_BYTE, GL_TRUE,
+                          stride, (void *)(intptr_t)weights_offset);
+  }
+
+  void set_texture_coords_attribute(int location) const {
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(location, 2, GL_HALF_FLOAT, GL_FALSE, stride,
+                          (void *)(intptr_t)texture_coords_offset);
+  }
+};
+
+// the smallest layout that holds vertices, given the highest bone id used
+// (-1 if none)
+inline VertexLayout choose_vertex_layout(int max_bone_id) {
+  if (max_bone_id < 0)
+    return VertexLayout::static_mesh;
+  if (max_bone_id < 256)
+    return VertexLayout::skinned;
+  return VertexLayout::skinned_wide;
+}
+
+// highest bone id any vertex uses, -1 if none
+inline int max_bone_id(const Vertex *vertices, size_t count) {
+  int max_id = -1;
+  for (size_t i = 0; i < count; i++)
+    for (int j = 0; j < MAX_BONE_WEIGHTS; j++)
+      if (vertices[i].weights[j] > 0.0f)
+        max_id = std::max(max_id, vertices[i].boneIds[j]);
+  return max_id;
+}
+
+// unit vector to two snorm16 on the octahedron folded onto a square
+inline void encode_octahedral(const glm::vec3 &normal, int16_t out[2]) {
+  float sum = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+  float x = sum > 0.0f ? normal.x / sum : 0.0f;
+  float y = sum > 0.0f ? normal.y / sum : 0.0f;
+  if (normal.z < 0.0f) {
+    float folded_x = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    float folded_y = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = folded_x;
+    y = folded_y;
+  }
+  out[0] = (int16_t)std::lround(glm::clamp(x, -1.0f, 1.0f) * 32767.0f);
+  out[1] = (int16_t)std::lround(glm::clamp(y, -1.0f, 1.0f) * 32767.0f);
+}
+
+/* weights to unorm8 that sum to exactly 255, so a vertex never gains or
+loses scale from rounding. Weights are normalized first, as Assimp's may not
+sum to one once influences past MAX_BONE_WEIGHTS are dropped */
+inline void encode_weights(const float weights[MAX_BONE_WEIGHTS],
+                           uint8_t out[MAX_BONE_WEIGHTS]) {
+  float sum = 0.0f;
+  for (int i = 0; i < MAX_BONE_WEIGHTS; i++)
+    sum += std::max(weights[i], 0.0f);
+  int total = 0, largest = 0;
+  for (int i = 0; i < MAX_BONE_WEIGHTS; i++) {
+    float weight = sum > 0.0f ? std::max(weights[i], 0.0f) / sum : 0.0f;
+    out[i] = (uint8_t)std::lround(weight * 255.0f);
+    total += out[i];
+    if (out[i] > out[largest])
+      largest = i;
+  }
+  if (total > 0)
+    out[largest] += 255 - total;
+}
+
+// vertices packed into layout, VertexFormat::of(layout).stride bytes each
+inline std::vector<unsigned char> pack_vertices(const Vertex *vertices,
+                                                size_t count,
+                                                VertexLayout layout) {
+  VertexFormat format = VertexFormat::of(layout);
+  std::vector<unsigned char> packed(format.stride * count);
+  for (size_t i = 0; i < count; i++) {
+    const Vertex &vertex = vertices[i];
+    unsigned char *out = packed.data() + format.stride * i;
+
+    int16_t normal[2];
+    encode_octahedral(vertex.normal, normal);
+    uint16_t texture_coords[2] = {glm::packHalf1x16(vertex.textureCoords.x),
+                                  glm::packHalf1x16(vertex.textureCoords.y)};
+    std::memcpy(out + VertexFormat::position_offset, &vertex.position, 12);
+    std::memcpy(out + VertexFormat::normal_offset, normal, 4);
+    std::memcpy(out + VertexFormat::texture_coords_offset, texture_coords, 4);
+    if (format.bone_id_type == 0)
+      continue;
+
+    uint8_t weights[MAX_BONE_WEIGHTS];
+    encode_weights(vertex.weights, weights);
+    std::memcpy(out + format.weights_offset, weights, MAX_BONE_WEIGHTS);
+    for (int j = 0; j < MAX_BONE_WEIGHTS; j++) {
+      int id = vertex.boneIds[j] < 0 || weights[j] == 0 ? 0 : vertex.boneIds[j];
+      if (format.bone_id_type == GL_UNSIGNED_BYTE) {
+        out[format.bone_ids_offset + j] = (uint8_t)id;
+      } else {
+        uint16_t wide_id = id;
+        std::memcpy(out + format.bone_ids_offset + 2 * j, &wide_id, 2);
+      }
+    }
+  }
+  return packed;
+}
+
+// 16 bit indices whenever every vertex can be addressed with them
+inline GLenum choose_index_type(size_t vertex_count) {
+  return vertex_count <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+inline int index_size(GLenum index_type) {
+  return index_type == GL_UNSIGNED_SHORT ? 2 : 4;
+}
+
+inline std::vector<unsigned char> pack_indices(const unsigned int *indices,
+                                               size_t count,
+                                               GLenum index_type) {
+  std::vector<unsigned char> packed(index_size(index_type) * count);
+  if (index_type == GL_UNSIGNED_INT) {
+    std::memcpy(packed.data(), indices, packed.size());
+    return packed;
+  }
+  for (size_t i = 0; i < count; i++) {
+    uint16_t index = indices[i];
+    std::memcpy(packed.data() + 2 * i, &index, 2);
+  }
+  return packed;
+}
+
+#endif